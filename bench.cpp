@@ -0,0 +1,191 @@
+#include "rutld.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Benchmarks of price catalog loading, price and country lookups and, with
+// --db, of the contact mapping SQL. Reports time and heap allocations per
+// operation. Run from a directory with the etc/ files of the module, e.g. the
+// source directory after make:
+//   make bench
+//   cd /usr/local/mgr5 && src/pmrutlddomains/rutldbench --db
+// --db uses the billmgr database (point it to a MySQL/MariaDB stand-in with
+// at least one service profile for the lookup hit); rows are written for
+// processing module -1 and deleted afterwards.
+
+namespace {
+
+std::atomic<long long> g_allocations(0);
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  void* ret = std::malloc(size ? size : 1);
+  if (!ret) throw std::bad_alloc();
+  return ret;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace {
+
+#define BENCH_MODULE -1
+
+template <typename Func>
+void Bench(const string& name, int iterations, Func func) {
+  func();  // Warm up caches.
+  long long allocations = g_allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    func();
+  }
+  double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  std::printf("%-48s %14.0f ns/op %12.1f allocs/op\n", name.c_str(),
+              ns / iterations,
+              static_cast<double>(g_allocations - allocations) / iterations);
+}
+
+// Price list with the given number of prices: four registrars per tld, ten
+// yearly periods each, like the RU-TLD price list.
+string WriteCatalog(int size) {
+  static const int registrars[] = {RUTLD_PROD_ARDIS_REGISTRAR_ID,
+                                   RUTLD_PROD_NIC_REGISTRAR_ID, 7, 11};
+  Json::array prices;
+  for (int i = 0; i < size; ++i) {
+    Json::array periods;
+    for (int year = 1; year <= 10; ++year) {
+      periods.push_back(Json::object{
+          {"id", str::Str(i * 10 + year)},
+          {"per_type", "year"},
+          {"p_length", str::Str(year)},
+          {"price_num", str::Str(100 + (i * 7) % 900 + year * 100)}});
+    }
+    prices.push_back(Json::object{
+        {"tld", i < 4 ? "ru" : "tld" + str::Str(i / 4)},
+        {"id", str::Str(i + 1)},
+        {"registrar_id", str::Str(registrars[i % 4])},
+        {"name", "price " + str::Str(i + 1)},
+        {"priority", ""},
+        {"period", periods}});
+  }
+  string path = "/tmp/" SHORT_NAME "bench." + str::Str(getpid()) + ".json";
+  std::ofstream(path) << Json(prices).dump();
+  return path;
+}
+
+void BenchCatalog() {
+  for (int size : {1000, 10000, 100000}) {
+    string path = WriteCatalog(size);
+    Bench("GetTldPrices " + str::Str(size), std::max(3, 100000 / size),
+          [&path] { GetTldPrices(path); });
+    auto catalog = GetTldPrices(path);
+    unlink(path.c_str());
+
+    const string tld = "tld" + str::Str(size / 4 - 1), ru = "ru";
+    for (int registrar : {-1, RUTLD_PROD_ARDIS_REGISTRAR_ID,
+                          RUTLD_PROD_NIC_REGISTRAR_ID}) {
+      string suffix =
+          " " + str::Str(size) + " registrar=" + str::Str(registrar);
+      Bench("FindDomainPrice" + suffix, 1000000, [&] {
+        FindDomainPrice(catalog.tld_prices, tld, -1, registrar);
+      });
+      // Price 2 is the NIC one, it is not found for other registrars.
+      Bench("FindDomainPrice advised" + suffix, 100000, [&] {
+        try {
+          FindDomainPrice(catalog.tld_prices, ru, 2, registrar);
+        } catch (const mgr_err::Error&) {
+        }
+      });
+    }
+  }
+}
+
+void BenchCountries() {
+  const auto& countries = GetRemoteCountries();
+  if (countries.id_by_iso2.empty()) return;
+  string iso2 = countries.id_by_iso2.rbegin()->first;
+  string id = countries.id_by_iso2.rbegin()->second;
+  Bench("GetRemoteCountryId", 1000000, [&iso2] { GetRemoteCountryId(iso2); });
+  Bench("GetRemoteCountryIso2", 1000000, [&id] { GetRemoteCountryIso2(id); });
+}
+
+void DeleteBenchRows() {
+  auto connection = GetContactDbConnection();
+  connection->Query("DELETE FROM " CONTACT_MAPPING_TABLE_NAME
+                    " WHERE processingmodule = ?",
+                    str::Str(BENCH_MODULE));
+  connection->Query("DELETE FROM " CONTACT_HASH_TABLE_NAME
+                    " WHERE processingmodule = ?",
+                    str::Str(BENCH_MODULE));
+}
+
+void BenchContactMapping() {
+  auto connection = GetContactDbConnection();
+  DeleteBenchRows();
+  string country = connection->Query("SELECT id FROM country LIMIT 1")->Str();
+  Bench("GetCountryIso2 cached", 1000000,
+        [&country] { GetCountryIso2(country); });
+
+  const int rows = 10000;
+  int written = 0, read = 0;
+  Bench("SetRemoteContactId", rows, [&written] {
+    ++written;
+    SetRemoteContactId(written, BENCH_MODULE, false, str::Str(written));
+  });
+  Bench("GetRemoteContactId", rows, [&read] {
+    GetRemoteContactId(++read % rows + 1, BENCH_MODULE, false);
+  });
+  // The rows above point to profile ids which need not exist, so the join
+  // with service_profile misses. The hit is measured on a row mapped to the
+  // first real profile.
+  const string remote_id = str::Str(rows / 2);
+  Bench("GetLocalContactId miss", rows,
+        [&remote_id] { GetLocalContactId(BENCH_MODULE, 0, remote_id); });
+  auto profile = connection->Query(
+      "SELECT id, account FROM service_profile ORDER BY id LIMIT 1");
+  if (profile->First()) {
+    int local_id = profile->AsInt("id"), account = profile->AsInt("account");
+    SetRemoteContactId(local_id, BENCH_MODULE, true, "bench");
+    if (GetLocalContactId(BENCH_MODULE, account, "bench") != local_id) {
+      throw mgr_err::Error("bench", "GetLocalContactId");
+    }
+    Bench("GetLocalContactId hit", rows, [account] {
+      GetLocalContactId(BENCH_MODULE, account, "bench");
+    });
+  } else {
+    std::printf("GetLocalContactId hit: no service profiles\n");
+  }
+  written = 0;
+  Bench("SetRemoteContactIdByHash", rows, [&written] {
+    ++written;
+    SetRemoteContactIdByHash(BENCH_MODULE, 0,
+                             GetContactHash({{"id", str::Str(written)}}),
+                             str::Str(written));
+  });
+  const string found = GetContactHash({{"id", remote_id}});
+  Bench("GetRemoteContactIdByHash", rows,
+        [&found] { GetRemoteContactIdByHash(BENCH_MODULE, 0, found); });
+  DeleteBenchRows();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  try {
+    BenchCatalog();
+    BenchCountries();
+    if (argc > 1 && string(argv[1]) == "--db") {
+      BenchContactMapping();
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
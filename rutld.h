@@ -0,0 +1,2115 @@
+// Module implementation shared by the processing module and the maintenance
+// programs built from this directory. Every program includes it from its only
+// translation unit.
+#ifndef RUTLD_H__
+#define RUTLD_H__
+
+#include <defines.h>
+#include <mgr/mgrhash.h>
+#include <mgr/mgrlog.h>
+#include <mgr/mgrregex.h>
+#include <mgr/mgrrpc.h>
+#include <mgr/mgrstr.h>
+#include <processing/domain_common.h>
+#include <processing/processingmodule.h>
+#include <table/dbobject.h>
+#include "config.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "json11/json11.hpp"
+
+// These variables are defined using build system in config.mk
+
+// Processing module name.
+// #define BINARY_NAME "pmrutlddomains"
+
+// Default URL.
+// #define RUTLD_PROD_URL "https://my.ru-tld.ru/manager/billmgr"
+
+// Project names to find the correct account ID.
+// #define RUTLD_PROJECT_NAME "*.ru-tld.ru (Domains)"
+
+// Item param name to store billmgr4 domain id.
+#define PARAM_REMOTE_ID "b4_remote_id"
+// Item param name to store billmgr4 pricelist id.
+#define PARAM_REMOTE_PRICE "b4_remote_price"
+
+// Table name to store contact mapping.
+#define CONTACT_MAPPING_TABLE_NAME "b4_contact_mapping"
+// Table name to store remote contacts by content hash.
+#define CONTACT_HASH_TABLE_NAME "b4_contact_hash"
+// Table name to store domain sync state.
+#define SYNC_STATE_TABLE_NAME "b4_sync_state"
+// Table name to cache domain availability checks.
+#define DOMAIN_CHECK_TABLE_NAME "b4_domain_check"
+
+// Environment variables to record registrar traffic to a trace file and to
+// replay it back instead of querying the remote API. Replay timings are
+// multiplied by the scale (1 by default, 0 disables delays).
+#define ENV_TRAFFIC_RECORD "RUTLD_TRAFFIC_RECORD"
+#define ENV_TRAFFIC_REPLAY "RUTLD_TRAFFIC_REPLAY"
+#define ENV_TRAFFIC_REPLAY_SCALE "RUTLD_TRAFFIC_REPLAY_SCALE"
+
+// Environment variable naming a file to append operation spans to in Chrome
+// trace event format.
+#define ENV_SPAN_TRACE "RUTLD_SPAN_TRACE"
+// Spans buffered before they are written in the middle of an operation, and
+// the longest time in seconds they are kept.
+#define SPAN_FLUSH_COUNT 256
+#define SPAN_FLUSH_INTERVAL 1
+
+// Registrar IDs.
+#define RUTLD_PROD_NIC_REGISTRAR_ID 5
+#define RUTLD_PROD_ARDIS_REGISTRAR_ID 13
+
+// Maximum number of simultaneous remote requests in bulk NS update.
+#define BULK_NS_CONCURRENCY 8
+
+// Lifetime in seconds of cached availability checks for free and taken
+// domains.
+#define CHECK_TTL_AVAILABLE (5 * 60)
+#define CHECK_TTL_TAKEN (30 * 60)
+
+// Domain sync intervals in seconds, see SyncInterval().
+#define SYNC_INTERVAL_TRANSITIONAL (15 * 60)
+#define SYNC_INTERVAL_EXPIRING (60 * 60)
+#define SYNC_INTERVAL_CHANGED (6 * 60 * 60)
+#define SYNC_INTERVAL_NEAR_EXPIRY (24 * 60 * 60)
+#define SYNC_INTERVAL_STABLE (7 * 24 * 60 * 60)
+// Domains missing from the remote domain list are retried this often.
+#define SYNC_INTERVAL_MISSING (24 * 60 * 60)
+// Domains closer to expiry than this number of days are synced more often.
+#define SYNC_EXPIRING_DAYS 30
+#define SYNC_NEAR_EXPIRY_DAYS 90
+// Domains whose remote status or expiration date changed within this number
+// of seconds are synced more often.
+#define SYNC_RECENT_CHANGE (7 * 24 * 60 * 60)
+// Maximum number of due items synced with one remote domain list.
+#define SYNC_BATCH_LIMIT 1000
+
+MODULE(BINARY_NAME);
+
+using namespace processing;
+using json11::Json;
+
+namespace {
+
+// List of zones with one contact only.
+const std::set<std::string> &RUSSIAN_ZONES() {
+  static const std::set<std::string> zones = []() {
+    std::set<std::string> ret;
+    for (const auto &zone: { "ru", "su", "рф", "ru.net", "москва", "moscow" }) {
+      ret.insert(str::puny::Encode(zone));
+    }
+    return ret;
+  }();
+  return zones;
+}
+
+struct DomainPrice {
+  string tld;
+  int id = -1;
+  int registrar_id = -1;
+  string name;
+  int priority = -1;
+  std::map<int, int> periods;
+  bool is_ru = false;
+  bool is_nic = false;
+  double one_year_price = -1;
+};
+
+const Json& NotNull(const Json& item, const string& key) {
+  const Json& ret = item[key];
+  if (ret.is_null()) {
+    throw mgr_err::Missed(key);
+  }
+  return ret;
+}
+
+int GetJsonInt(const Json& item) {
+  if (item.is_number()) {
+    return item.int_value();
+  } else if (item.is_string()) {
+    int rv = str::Int(item.string_value());
+    if (str::Str(rv) != item.string_value()) {
+      throw mgr_err::Error("json_string_not_an_int: " + item.string_value());
+    }
+    return rv;
+  } else {
+    throw mgr_err::Error("json_bad_int_type");
+  }
+}
+
+int GetJsonInt(const Json& parent, const string& key) {
+  return GetJsonInt(NotNull(parent, key));
+}
+
+int GetPriority(const Json &parent) {
+  auto item = NotNull(parent, "priority");
+  return (item.is_string() && item.string_value().size() == 0) ? 0 : GetJsonInt(item);
+}
+
+Json ReadJsonFromFile(const string& path) {
+  string content_string = mgr_file::Read(path);
+  string json_parse_error;
+  Json content = Json::parse(content_string, json_parse_error);
+  if (content.is_null()) {
+    throw mgr_err::Value("json", json_parse_error);
+  }
+  return content;
+}
+
+string GetEnv(const char* name) {
+  const char* value = std::getenv(name);
+  return value ? value : "";
+}
+
+// FNV-1a, 64 bit, as 16 hex digits.
+string HashHex(const string& data) {
+  unsigned long long hash = 14695981039346656037ULL;
+  for (unsigned char c : data) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx", hash);
+  return hex;
+}
+
+// Registrar API client. The id names the registrar account the client works
+// with (URL and a hash of the user name) in traffic traces.
+class RemoteClient : public mgr_client::Remote {
+ public:
+  RemoteClient(const string& url, const string& authinfo)
+      : mgr_client::Remote(url), id(Id(url, authinfo)) {
+    AddParam("authinfo", authinfo);
+  }
+
+  static string Id(const string& url, const string& authinfo) {
+    return url + " " + HashHex(authinfo.substr(0, authinfo.find(':')));
+  }
+
+  const string id;
+};
+
+// Registrar traffic trace. Every remote request is appended to the record file
+// as one JSON line with credentials scrubbed and the id of the client. In
+// replay mode responses are served from such a file: identical requests of
+// the same client get their responses in the order they were recorded. A
+// responder function may serve the responses instead of a file.
+class RemoteTrace {
+ public:
+  static RemoteTrace& Instance() {
+    static RemoteTrace trace;
+    return trace;
+  }
+
+  typedef std::function<string(const string& client, const StringMap& params)>
+      Responder;
+
+  bool IsReplay() const { return replay_; }
+
+  // Serves replayed responses from the function, which returns the response
+  // XML or throws. Must be set before requests are made.
+  void SetResponder(Responder responder) {
+    responder_ = std::move(responder);
+    replay_ = true;
+  }
+
+  void Record(const string& client, const StringMap& params,
+              const string& response, const string& error, long ms) {
+    if (record_ == -1) return;
+    Json::object json_params;
+    for (const auto& i : Scrub(params)) {
+      json_params[i.first] = i.second;
+    }
+    Json::object line{{"client", client},
+                      {"params", json_params},
+                      {"ms", static_cast<int>(ms)}};
+    if (!error.empty()) {
+      line["error"] = error;
+    } else {
+      line["response"] = response;
+    }
+    // One write to an O_APPEND descriptor, so lines of processes recording
+    // to the same file do not interleave.
+    string out = Json(line).dump() + "\n";
+    if (write(record_, out.data(), out.size()) !=
+        static_cast<ssize_t>(out.size())) {
+      Warning("Failed to write traffic trace");
+    }
+  }
+
+  mgr_client::Result Replay(const string& client, const StringMap& params) {
+    if (responder_) {
+      return mgr_client::Result(
+          mgr_xml::XmlString(responder_(client, Scrub(params))));
+    }
+    Json entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& queue = responses_[Key(client, params)];
+      if (queue.empty()) {
+        auto func = params.find("func");
+        throw mgr_err::Missed("replay_response",
+                              func != params.end() ? func->second : "");
+      }
+      entry = std::move(queue.front());
+      queue.pop_front();
+    }
+    if (scale_ > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(
+          static_cast<long>(entry["ms"].number_value() * 1000 * scale_)));
+    }
+    if (!entry["error"].is_null()) {
+      throw mgr_err::Error(entry["error"].string_value());
+    }
+    return mgr_client::Result(
+        mgr_xml::XmlString(entry["response"].string_value()));
+  }
+
+ private:
+  bool replay_ = false;
+  double scale_ = 1;
+  int record_ = -1;
+  std::map<string, std::deque<Json>> responses_;
+  std::mutex mutex_;
+  Responder responder_;
+
+  RemoteTrace() {
+    string replay_path = GetEnv(ENV_TRAFFIC_REPLAY);
+    if (!replay_path.empty()) {
+      replay_ = true;
+      string scale = GetEnv(ENV_TRAFFIC_REPLAY_SCALE);
+      if (!scale.empty()) scale_ = str::Double(scale);
+      std::ifstream in(replay_path);
+      if (!in) throw mgr_err::Value("trace", replay_path);
+      string line;
+      while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        string json_parse_error;
+        Json entry = Json::parse(line, json_parse_error);
+        if (entry.is_null()) {
+          throw mgr_err::Value("trace", json_parse_error);
+        }
+        StringMap params;
+        for (const auto& i : entry["params"].object_items()) {
+          params[i.first] = i.second.string_value();
+        }
+        responses_[Key(entry["client"].string_value(), params)].push_back(
+            std::move(entry));
+      }
+      return;
+    }
+    string record_path = GetEnv(ENV_TRAFFIC_RECORD);
+    if (!record_path.empty()) {
+      record_ = open(record_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (record_ == -1) {
+        Warning("Failed to open traffic trace %s", record_path.c_str());
+      }
+    }
+  }
+
+  static StringMap Scrub(StringMap params) {
+    for (const auto& name : {"authinfo", "username", "password", "passwd"}) {
+      auto it = params.find(name);
+      if (it != params.end()) it->second = "*";
+    }
+    return params;
+  }
+
+  static string Key(const string& client, const StringMap& params) {
+    return client + " " + str::JoinParams(Scrub(params), "&", "=");
+  }
+};
+
+// Span tracer. Finished spans are appended to the trace file when an
+// operation (the outermost span of a thread) ends, and also every
+// SPAN_FLUSH_COUNT spans or SPAN_FLUSH_INTERVAL seconds, so killed runs keep
+// the spans finished so far. Each flush is a single write to a descriptor
+// opened with O_APPEND, so processes sharing the file do not mix their lines.
+// A disabled tracer costs a single check per span. Chrome trace viewers show
+// nesting by time containment.
+class SpanTracer {
+ public:
+  static SpanTracer& Instance() {
+    static SpanTracer tracer;
+    return tracer;
+  }
+
+  bool IsEnabled() const { return !path_.empty(); }
+
+  static long long Now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void Add(const char* name, const string& detail, long long start,
+           long long end, bool outermost) {
+    size_t tid = std::hash<std::thread::id>()(std::this_thread::get_id());
+    Json::object event{{"name", name},
+                       {"ph", "X"},
+                       {"ts", static_cast<double>(start)},
+                       {"dur", static_cast<double>(end - start)},
+                       {"pid", static_cast<int>(getpid())},
+                       {"tid", static_cast<double>(tid % 1000000)}};
+    if (!detail.empty()) {
+      event["args"] = Json::object{{"detail", detail}};
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_ += Json(event).dump() + ",\n";
+    if (outermost || ++buffered_ >= SPAN_FLUSH_COUNT ||
+        end - last_flush_ >= SPAN_FLUSH_INTERVAL * 1000000LL) {
+      Flush(end);
+    }
+  }
+
+  ~SpanTracer() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Flush(Now());
+    if (fd_ != -1) close(fd_);
+  }
+
+ private:
+  string path_;
+  string buffer_;
+  int buffered_ = 0;
+  long long last_flush_ = 0;
+  int fd_ = -1;
+  std::mutex mutex_;
+
+  SpanTracer() : path_(GetEnv(ENV_SPAN_TRACE)), last_flush_(Now()) {}
+
+  void Flush(long long now) {
+    last_flush_ = now;
+    buffered_ = 0;
+    if (buffer_.empty()) return;
+    if (fd_ == -1) Open();
+    if (fd_ != -1 && write(fd_, buffer_.data(), buffer_.size()) < 0) {
+      Warning("Failed to write span trace %s", path_.c_str());
+    }
+    buffer_.clear();
+  }
+
+  // The file is created with the array header in one step: the header is
+  // written to a temporary file, which is linked to the trace path only if
+  // no process has created it yet.
+  void Open() {
+    string tmp = path_ + "." + str::Str(static_cast<int>(getpid()));
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1) {
+      bool written = write(fd, "[\n", 2) == 2;
+      close(fd);
+      if (written && link(tmp.c_str(), path_.c_str()) != 0 &&
+          errno != EEXIST) {
+        Warning("Failed to create span trace %s", path_.c_str());
+      }
+      unlink(tmp.c_str());
+    }
+    fd_ = open(path_.c_str(), O_WRONLY | O_APPEND);
+    if (fd_ == -1) {
+      Warning("Failed to open span trace %s", path_.c_str());
+    }
+  }
+};
+
+class Span {
+ public:
+  explicit Span(const char* name, const string& detail = string()) {
+    if (SpanTracer::Instance().IsEnabled()) {
+      name_ = name;
+      detail_ = detail;
+      ++Depth();
+      start_ = SpanTracer::Now();
+    }
+  }
+
+  ~Span() {
+    if (name_) {
+      SpanTracer::Instance().Add(name_, detail_, start_, SpanTracer::Now(),
+                                 --Depth() == 0);
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+ private:
+  const char* name_ = nullptr;
+  string detail_;
+  long long start_ = 0;
+
+  // Number of open spans of the thread.
+  static int& Depth() {
+    static thread_local int depth = 0;
+    return depth;
+  }
+};
+
+template <typename Func>
+auto Traced(const char* name, Func func) -> decltype(func()) {
+  Span span(name);
+  return func();
+}
+
+string QueryFunc(const string& query) {
+  auto begin = query.find("func=");
+  if (begin == string::npos) return query;
+  begin += 5;
+  return query.substr(begin, query.find('&', begin) - begin);
+}
+
+// Billmgr API (sbin and the base class helpers) is not known to be
+// thread-safe, so operations running concurrently serialize calls to it.
+std::recursive_mutex& BillmgrMutex() {
+  static std::recursive_mutex mutex;
+  return mutex;
+}
+
+// Takes the billmgr lock before a call span is opened, so that call spans
+// measure the call alone. Waiting for another operation is traced separately.
+std::unique_lock<std::recursive_mutex> LockBillmgr(const string& name) {
+  std::unique_lock<std::recursive_mutex> lock(BillmgrMutex(), std::try_to_lock);
+  if (!lock.owns_lock()) {
+    Span span("BillmgrWait", name);
+    lock.lock();
+  }
+  return lock;
+}
+
+template <typename Func>
+auto BillmgrCall(const char* name, Func func) -> decltype(func()) {
+  auto lock = LockBillmgr(name);
+  Span span(name);
+  return func();
+}
+
+// sbin::ClientQuery wrappers to trace billmgr callbacks.
+auto ClientQuery(const string& query) -> decltype(sbin::ClientQuery(query)) {
+  auto lock = LockBillmgr(QueryFunc(query));
+  Span span("ClientQuery", QueryFunc(query));
+  return sbin::ClientQuery(query);
+}
+
+auto ClientQuery(const string& func, const StringMap& params)
+    -> decltype(sbin::ClientQuery(func, params)) {
+  auto lock = LockBillmgr(func);
+  Span span("ClientQuery", func);
+  return sbin::ClientQuery(func, params);
+}
+
+// Canonical NS set to compare NS lists regardless of order, case, trailing
+// dots and extra spaces. Glue addresses following the host name are kept.
+std::set<string> NormalizeNs(const StringVector& ns) {
+  std::set<string> ret;
+  for (const auto& i : ns) {
+    StringVector words;
+    str::Split(str::Lower(i), " ", words);
+    StringVector normalized;
+    for (auto word : words) {
+      word = str::Trim(word);
+      if (word.empty()) continue;
+      if (normalized.empty()) {
+        while (!word.empty() && word.back() == '.') word.pop_back();
+      }
+      normalized.push_back(word);
+    }
+    if (!normalized.empty()) ret.insert(str::Join(normalized, " "));
+  }
+  return ret;
+}
+
+struct NsUpdateReport {
+  int changed = 0;
+  int skipped = 0;
+  int failed = 0;
+};
+
+struct ReconcileReport {
+  int matched = 0;
+  int remote_orphans = 0;
+  int local_orphans = 0;
+  int status_mismatches = 0;
+  int expire_mismatches = 0;
+  int price_mismatches = 0;
+};
+
+// Remote ids are compared as numbers when they are numbers: shorter ids go
+// first. The same order is used in SQL to merge local and remote lists.
+bool RemoteIdLess(const string& lhs, const string& rhs) {
+  return lhs.size() != rhs.size() ? lhs.size() < rhs.size() : lhs < rhs;
+}
+
+// Domain prices by tld and the registrars found in the price list. The
+// catalog is loaded once and never changed, so it is shared by all threads.
+struct PriceCatalog {
+  std::map<string, std::vector<DomainPrice>> tld_prices;
+  std::set<int> registrars;
+};
+
+PriceCatalog GetTldPrices(
+    const string& path = "etc/" SHORT_NAME "_domainprice.json") {
+  Span span("GetTldPrices");
+  // TODO: embed this file in the binary?
+  Json content =
+      Traced("ReadDomainPriceJson", [&path] { return ReadJsonFromFile(path); });
+  if (!content.is_array()) {
+    throw mgr_err::Value("json", "Not an array");
+  }
+  StringVector ru_suffixes;
+  for (const auto& i : RUSSIAN_ZONES()) {
+    ru_suffixes.push_back("." + i);
+  }
+  PriceCatalog catalog;
+  std::vector<DomainPrice> items;
+  items.reserve(content.array_items().size());
+  for (const auto& json_item : content.array_items()) {
+    DomainPrice item;
+    item.tld = str::puny::Encode(NotNull(json_item, "tld").string_value());
+    item.id = GetJsonInt(json_item, "id");
+    item.registrar_id = GetJsonInt(json_item, "registrar_id");
+    catalog.registrars.insert(item.registrar_id);
+    item.name = NotNull(json_item, "name").string_value();
+    item.priority = GetPriority(json_item);
+    for (const auto& json_period : NotNull(json_item, "period").array_items()) {
+      if (json_period["per_type"].string_value() != "year") {
+        Warning("Skipping period type %s for price %d",
+                json_period["per_type"].string_value().c_str(), item.id);
+        continue;
+      }
+      int length = GetJsonInt(json_period, "p_length");
+      item.periods[length] = GetJsonInt(json_period, "id");
+      if (length == 1) {
+        item.one_year_price =
+            str::Double(NotNull(json_period, "price_num").string_value());
+      }
+    }
+    if (item.registrar_id == RUTLD_PROD_NIC_REGISTRAR_ID) {
+      item.is_nic = true;
+    }
+    item.is_ru = RUSSIAN_ZONES().count(item.tld) != 0;
+    for (const auto& i : ru_suffixes) {
+      if (item.is_ru) break;
+      item.is_ru = str::EndsWith(item.tld, i);
+    }
+    items.emplace_back(std::move(item));
+  }
+
+  std::sort(items.begin(), items.end(), [](const DomainPrice& lhs,
+                                           const DomainPrice& rhs) {
+    // Ardis domains go first.
+    bool lhs_ardis = lhs.registrar_id == RUTLD_PROD_ARDIS_REGISTRAR_ID,
+         rhs_ardis = rhs.registrar_id == RUTLD_PROD_ARDIS_REGISTRAR_ID;
+    if (lhs_ardis != rhs_ardis) return lhs_ardis > rhs_ardis;
+    // Cheapest domains go first.
+    if (lhs.one_year_price != rhs.one_year_price)
+      return lhs.one_year_price < rhs.one_year_price;
+    // Id is unique, the domain with least id goes first.
+    return lhs.id < rhs.id;
+  });
+
+  auto& tld_prices = catalog.tld_prices;
+  for (auto& item : items) {
+    Debug("Pushing price tld=%s registrar_id=%d id=%d", item.tld.c_str(),
+      item.registrar_id, item.id);
+    tld_prices[item.tld].push_back(std::move(item));
+  }
+  Debug("Loaded %zu prices for %zu tlds", items.size(), tld_prices.size());
+  return catalog;
+}
+
+// Price of the tld with the advised id or, without advice, the first one. Only
+// prices of the allowed registrar are used unless it is -1.
+const DomainPrice& FindDomainPrice(
+    const std::map<string, std::vector<DomainPrice>>& tld_prices,
+    const string& tld, int advise, int allowed_registrar) {
+  if (advise == -1 && allowed_registrar != -1) {
+    return tld_prices.at(tld).at(0);
+  } else {
+    for (const auto& i : tld_prices.at(tld)) {
+      if ((i.id == advise || advise == -1) &&
+          (i.registrar_id == allowed_registrar || allowed_registrar == -1)) {
+        return i;
+      }
+    }
+    throw mgr_err::Error("wrong_pricelist_id_for_tld");
+  }
+}
+
+const PriceCatalog& GetPriceCatalog() {
+  static const PriceCatalog catalog = GetTldPrices();
+  return catalog;
+}
+
+// Remote country ids by iso2 codes and back. Both maps are read from the
+// countries file at once on first use.
+struct RemoteCountries {
+  StringMap id_by_iso2;
+  StringMap iso2_by_id;
+};
+
+const RemoteCountries& GetRemoteCountries() {
+  static const RemoteCountries countries = []() {
+    Span span("GetRemoteCountries");
+    RemoteCountries ret;
+    Json content = ReadJsonFromFile("etc/" SHORT_NAME "_countries.json");
+    for (const auto& country : content["elem"].array_items()) {
+      ret.id_by_iso2[country["iso2"].string_value()] =
+          country["id"].string_value();
+      ret.iso2_by_id[country["id"].string_value()] =
+          country["iso2"].string_value();
+    }
+    return ret;
+  }();
+  return countries;
+}
+
+string GetRemoteCountryId(const string& iso2) {
+  const auto& map = GetRemoteCountries().id_by_iso2;
+  auto it = map.find(iso2);
+  return it != map.end() ? it->second
+                         : throw mgr_err::Missed("remote_country", iso2);
+}
+
+string GetRemoteCountryIso2(const string &id) {
+  const auto& map = GetRemoteCountries().iso2_by_id;
+  auto it = map.find(id);
+  return it != map.end() ? it->second
+                         : throw mgr_err::Missed("remote_country", id);
+}
+
+// Local countries do not change while the module runs, so each one is
+// queried once per process.
+string GetCountryIso2(const string& local_id) {
+  std::lock_guard<std::recursive_mutex> lock(BillmgrMutex());
+  static StringMap cache;
+  auto it = cache.find(local_id);
+  if (it != cache.end()) return it->second;
+  Span span("GetCountryIso2");
+  return cache[local_id] = sbin::DB()
+                               ->Query("SELECT iso2 FROM country WHERE id = " +
+                                       sbin::DB()->EscapeValue(local_id))
+                               ->Str();
+}
+
+string GetCountryId(const string& iso2) {
+  std::lock_guard<std::recursive_mutex> lock(BillmgrMutex());
+  static StringMap cache;
+  auto it = cache.find(iso2);
+  if (it != cache.end()) return it->second;
+  Span span("GetCountryId");
+  return cache[iso2] = sbin::DB()
+                           ->Query("SELECT id FROM country WHERE iso2 = " +
+                                   sbin::DB()->EscapeValue(iso2))
+                           ->Str();
+}
+
+// We cannot use billmanager externalid mapping for contacts as one local
+// contact id should match exactly two remote contacts generic and not generic
+// ones. We cannot tie it to billmanager contact type (owner / tech / bill /
+// ...) as owner will be a generic contact for some zones and not generic for
+// other zones.
+// Hence, we will create a separate table in billmanager database to track these
+// matches. We don't use mgr_db::Table as we don't want to add a plugin to the
+// billmgr process.
+
+mgr_db::Connection* GetContactDbConnection() {
+  Span span("GetContactDbConnection");
+  // TODO: We need a separate database connection not to interfere with JobCache
+  // transactions
+  // Each thread has its own connection, the table is checked once.
+  static thread_local mgr_db::Connection* connection =
+      BillmgrCall("GetConnection", [] { return sbin::DB()->GetConnection(); });
+  static std::once_flag ensured;
+  std::call_once(ensured, []() {
+    if (!connection->Query("SHOW TABLES LIKE '" CONTACT_MAPPING_TABLE_NAME "'")
+             ->First()) {
+      connection->Query(
+          "CREATE TABLE " CONTACT_MAPPING_TABLE_NAME
+          "(processingmodule int(11) NOT NULL, "
+          "service_profile int(11) NOT NULL, "
+          "is_generic bool NOT NULL, "
+          "externalid varchar(64) NOT NULL, "
+          "PRIMARY KEY (processingmodule, service_profile, is_generic)) "
+          "ENGINE=InnoDB DEFAULT CHARSET=utf8");
+    }
+    if (!connection->Query("SHOW TABLES LIKE '" CONTACT_HASH_TABLE_NAME "'")
+             ->First()) {
+      connection->Query(
+          "CREATE TABLE " CONTACT_HASH_TABLE_NAME
+          "(processingmodule int(11) NOT NULL, "
+          "account int(11) NOT NULL, "
+          "hash char(16) NOT NULL, "
+          "externalid varchar(64) NOT NULL, "
+          "PRIMARY KEY (processingmodule, account, hash)) "
+          "ENGINE=InnoDB DEFAULT CHARSET=utf8");
+    }
+  });
+  return connection;
+}
+
+string GetRemoteContactId(int local_id, int processing_module,
+                          bool is_generic) {
+  Span span("GetRemoteContactId");
+  return GetContactDbConnection()
+      ->Query(
+          "SELECT externalid FROM " CONTACT_MAPPING_TABLE_NAME
+          " WHERE processingmodule=? AND service_profile=? AND is_generic=?",
+          str::Str(processing_module), str::Str(local_id), str::Str(is_generic))
+      ->Str();
+}
+
+// Profile of the account mapped to the remote contact, -1 if there is none.
+// Profiles of one account with identical content share a remote contact.
+int GetLocalContactId(int processing_module, int account,
+                      const string& remote_id) {
+  Span span("GetLocalContactId");
+  auto cursor = GetContactDbConnection()->Query(
+      "SELECT m.service_profile FROM " CONTACT_MAPPING_TABLE_NAME " m "
+      "JOIN service_profile p ON p.id = m.service_profile "
+      "WHERE m.processingmodule=? AND m.externalid=? AND p.account=? "
+      "ORDER BY m.service_profile LIMIT 1",
+      str::Str(processing_module), remote_id, str::Str(account));
+  return cursor->First() ? cursor->Int() : -1;
+}
+
+int GetProfileAccount(int local_id) {
+  Span span("GetProfileAccount");
+  return str::Int(GetContactDbConnection()
+                      ->Query("SELECT account FROM service_profile WHERE id=?",
+                              str::Str(local_id))
+                      ->Str());
+}
+
+void SetRemoteContactId(int local_id, int processing_module, bool is_generic,
+                        const string& remote_id) {
+  Span span("SetRemoteContactId");
+  GetContactDbConnection()->Query("INSERT INTO " CONTACT_MAPPING_TABLE_NAME
+                                  " (processingmodule, service_profile, "
+                                  "is_generic, externalid) VALUES (?,?,?,?)",
+                                  str::Str(processing_module),
+                                  str::Str(local_id), str::Str(is_generic),
+                                  remote_id);
+}
+
+// Identical contacts of different profiles of one account share one remote
+// contact. They are found by the account and a hash of the normalized
+// domaincontact.edit payload. Contacts are never shared between accounts, as
+// imported domains are linked to the profiles of their remote contacts.
+
+string GetContactHash(const StringMap& payload) {
+  Json::object normalized;
+  for (const auto& i : payload) {
+    normalized[i.first] = str::Trim(i.first == "email" ? str::Lower(i.second)
+                                                       : i.second);
+  }
+  return HashHex(Json(normalized).dump());
+}
+
+string GetRemoteContactIdByHash(int processing_module, int account,
+                                const string& hash) {
+  Span span("GetRemoteContactIdByHash");
+  return GetContactDbConnection()
+      ->Query("SELECT externalid FROM " CONTACT_HASH_TABLE_NAME
+              " WHERE processingmodule=? AND account=? AND hash=?",
+              str::Str(processing_module), str::Str(account), hash)
+      ->Str();
+}
+
+void SetRemoteContactIdByHash(int processing_module, int account,
+                              const string& hash, const string& remote_id) {
+  Span span("SetRemoteContactIdByHash");
+  GetContactDbConnection()->Query(
+      "INSERT IGNORE INTO " CONTACT_HASH_TABLE_NAME
+      " (processingmodule, account, hash, externalid) VALUES (?,?,?,?)",
+      str::Str(processing_module), str::Str(account), hash, remote_id);
+}
+
+// Domain availability cache. Free domains are cached for a shorter time as
+// they may be registered by anyone at any moment.
+
+mgr_db::Connection* GetCheckDbConnection() {
+  mgr_db::Connection* connection = GetContactDbConnection();
+  static std::once_flag ensured;
+  std::call_once(ensured, [connection]() {
+    if (connection->Query("SHOW TABLES LIKE '" DOMAIN_CHECK_TABLE_NAME "'")
+            ->First()) {
+      return;
+    }
+    connection->Query(
+        "CREATE TABLE " DOMAIN_CHECK_TABLE_NAME
+        "(domain varchar(255) NOT NULL, "
+        "available bool NOT NULL, "
+        "expire datetime NOT NULL, "
+        "PRIMARY KEY (domain)) "
+        "ENGINE=InnoDB DEFAULT CHARSET=utf8");
+  });
+  return connection;
+}
+
+// Returns cached availability of the domains that have not expired yet.
+std::map<string, bool> GetCachedAvailability(const std::set<string>& domains) {
+  Span span("GetCachedAvailability");
+  std::map<string, bool> ret;
+  if (domains.empty()) return ret;
+  StringVector escaped;
+  for (const auto& i : domains) {
+    escaped.push_back(GetCheckDbConnection()->EscapeValue(i));
+  }
+  auto cursor = GetCheckDbConnection()->Query(
+      "SELECT domain, available FROM " DOMAIN_CHECK_TABLE_NAME
+      " WHERE expire > NOW() AND domain IN (" + str::Join(escaped, ",") + ")");
+  for (; !cursor->Eof(); cursor->Next()) {
+    ret[cursor->AsString("domain")] = cursor->AsInt("available") != 0;
+  }
+  return ret;
+}
+
+void SetCachedAvailability(const string& domain, bool available) {
+  Span span("SetCachedAvailability");
+  GetCheckDbConnection()->Query(
+      "REPLACE INTO " DOMAIN_CHECK_TABLE_NAME
+      " (domain, available, expire) VALUES (?, ?, NOW() + INTERVAL ? SECOND)",
+      domain, str::Str(available),
+      str::Str(available ? CHECK_TTL_AVAILABLE : CHECK_TTL_TAKEN));
+}
+
+// Domain sync state. Each sync stores the remote status and expiration date
+// of a domain and schedules its next sync. Items due for sync are synced in
+// batches by the sync_due maintenance command and along with any billmgr
+// SyncItem call of the module.
+
+struct RemoteDomain {
+  int status = -1;
+  string expiredate;
+};
+
+struct SyncState {
+  int item = 0;
+  string remote_id;
+  string local_expiredate;
+  bool has_state = false;
+  int remote_status = -1;
+  string expiredate;
+  long since_change = 0;
+};
+
+mgr_db::Connection* GetSyncDbConnection() {
+  mgr_db::Connection* connection = GetContactDbConnection();
+  static std::once_flag ensured;
+  std::call_once(ensured, [connection]() {
+    if (connection->Query("SHOW TABLES LIKE '" SYNC_STATE_TABLE_NAME "'")
+            ->First()) {
+      return;
+    }
+    connection->Query(
+        "CREATE TABLE " SYNC_STATE_TABLE_NAME
+        "(item int(11) NOT NULL, "
+        "processingmodule int(11) NOT NULL, "
+        "remote_status int(11) NOT NULL, "
+        "expiredate varchar(32) NOT NULL, "
+        "last_change datetime NOT NULL, "
+        "next_sync datetime NOT NULL, "
+        "PRIMARY KEY (item), "
+        "KEY (processingmodule, next_sync)) "
+        "ENGINE=InnoDB DEFAULT CHARSET=utf8");
+  });
+  return connection;
+}
+
+// Columns of the sync state table joined as s.
+#define SYNC_STATE_COLUMNS                                         \
+  "s.remote_status, s.expiredate, "                                \
+  "TIMESTAMPDIFF(SECOND, s.last_change, NOW()) AS since_change "
+
+// Fills the state from the SYNC_STATE_COLUMNS of the cursor row.
+void ReadSyncState(const mgr_db::QueryPtr& cursor, SyncState& state) {
+  state.has_state = !cursor->AsString("remote_status").empty();
+  if (state.has_state) {
+    state.remote_status = cursor->AsInt("remote_status");
+    state.expiredate = cursor->AsString("expiredate");
+    state.since_change = str::Int(cursor->AsString("since_change"));
+  }
+}
+
+// Returns sync state of the item. Remote id and local expiration date are
+// passed by the caller, as the operation may have just changed them in its
+// own billmgr transaction.
+SyncState GetSyncState(int item, const string& remote_id,
+                       const string& local_expiredate) {
+  Span span("GetSyncState");
+  SyncState state;
+  state.item = item;
+  state.remote_id = remote_id;
+  state.local_expiredate = local_expiredate;
+  auto cursor = GetSyncDbConnection()->Query(
+      "SELECT " SYNC_STATE_COLUMNS "FROM " SYNC_STATE_TABLE_NAME
+      " s WHERE s.item = ?",
+      str::Str(item));
+  if (cursor->First()) {
+    ReadSyncState(cursor, state);
+  }
+  return state;
+}
+
+// Returns sync state of up to SYNC_BATCH_LIMIT active items of the module
+// which are due for sync, least recent first.
+std::vector<SyncState> GetDueSyncStates(int processing_module) {
+  Span span("GetDueSyncStates");
+  auto cursor = GetSyncDbConnection()->Query(
+      "SELECT i.id AS item, i.expiredate AS local_expiredate, "
+      "p.value AS remote_id, " SYNC_STATE_COLUMNS
+      "FROM item i "
+      "JOIN itemparam p ON p.item = i.id AND p.intname = '" PARAM_REMOTE_ID
+      "' LEFT JOIN " SYNC_STATE_TABLE_NAME
+      " s ON s.item = i.id WHERE i.processingmodule = ? "
+      "AND i.status IN (2, 3) "
+      "AND (s.item IS NULL OR s.next_sync <= NOW()) "
+      "ORDER BY s.next_sync LIMIT " +
+          str::Str(SYNC_BATCH_LIMIT),
+      str::Str(processing_module));
+  std::vector<SyncState> ret;
+  for (; !cursor->Eof(); cursor->Next()) {
+    SyncState state;
+    state.item = cursor->AsInt("item");
+    state.remote_id = cursor->AsString("remote_id");
+    state.local_expiredate = cursor->AsString("local_expiredate");
+    ReadSyncState(cursor, state);
+    ret.push_back(state);
+  }
+  return ret;
+}
+
+// Days from today to the date in YYYY-MM-DD format, -1 if it is not a date.
+int DaysUntil(const string& date) {
+  std::tm tm = {};
+  if (std::sscanf(date.c_str(), "%d-%d-%d", &tm.tm_year, &tm.tm_mon,
+                  &tm.tm_mday) != 3) {
+    return -1;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_hour = 12;
+  return static_cast<int>(
+      std::difftime(std::mktime(&tm), std::time(nullptr)) / (24 * 60 * 60));
+}
+
+// Domains in a transitional status, close to expiry or recently changed are
+// polled often, stable delegated domains rarely.
+int SyncInterval(int remote_status, const string& expiredate,
+                 long since_change) {
+  if (remote_status != 2 && remote_status != 3) {
+    return SYNC_INTERVAL_TRANSITIONAL;
+  }
+  int days = DaysUntil(expiredate);
+  if (days < SYNC_EXPIRING_DAYS) {
+    return SYNC_INTERVAL_EXPIRING;
+  }
+  if (since_change < SYNC_RECENT_CHANGE) {
+    return SYNC_INTERVAL_CHANGED;
+  }
+  if (remote_status == 3 || days < SYNC_NEAR_EXPIRY_DAYS) {
+    return SYNC_INTERVAL_NEAR_EXPIRY;
+  }
+  return SYNC_INTERVAL_STABLE;
+}
+
+// Saves the synced state. The next sync is scheduled by SyncInterval()
+// unless the interval is given.
+void SaveSyncState(const SyncState& state, int processing_module,
+                   int remote_status, const string& expiredate,
+                   int interval = -1) {
+  Span span("SaveSyncState");
+  bool changed = !state.has_state || state.remote_status != remote_status ||
+                 state.expiredate != expiredate;
+  if (interval < 0) {
+    interval = SyncInterval(remote_status, expiredate,
+                            changed ? 0 : state.since_change);
+  }
+  GetSyncDbConnection()->Query(
+      "INSERT INTO " SYNC_STATE_TABLE_NAME
+      " (item, processingmodule, remote_status, expiredate, last_change, "
+      "next_sync) VALUES (?, ?, ?, ?, NOW(), NOW() + INTERVAL ? SECOND) "
+      "ON DUPLICATE KEY UPDATE processingmodule = VALUES(processingmodule), "
+      "last_change = IF(?, NOW(), last_change), "
+      "remote_status = VALUES(remote_status), "
+      "expiredate = VALUES(expiredate), next_sync = VALUES(next_sync)",
+      str::Str(state.item), str::Str(processing_module),
+      str::Str(remote_status), expiredate, str::Str(interval),
+      str::Str(changed));
+}
+
+class CLASS_NAME : public Registrator {
+ protected:
+  // Module connection state filled by OnSetModule. It is kept per thread, so
+  // operations running concurrently in one process use their own modules.
+  struct Context {
+    string username;
+    string password;
+    string url;
+    int allowed_registrar = -1;
+    std::unique_ptr<RemoteClient> client;
+    int processing_module = 0;
+  };
+
+  const std::map<string, std::vector<DomainPrice>>& tld_prices_;
+
+  static Context& Ctx() {
+    static thread_local Context context;
+    return context;
+  }
+
+  // Billmgr data used by the operations. The stress test overrides these to
+  // run the operations against a fake billmgr.
+  virtual void UseModule(int module) {
+    BillmgrCall("SetModule", [&] { SetModule(module); });
+  }
+
+  // Item fields: processingmodule, pricelist, period, intname, expiredate.
+  virtual StringMap GetItem(int iid) {
+    auto item_query = BillmgrCall("ItemQuery", [&] { return ItemQuery(iid); });
+    StringMap item;
+    for (const char* name :
+         {"processingmodule", "pricelist", "period", "intname", "expiredate"}) {
+      item[name] = item_query->AsString(name);
+    }
+    return item;
+  }
+
+  // Item params, with tld params if with_tld is set and with addons of the
+  // pricelist if it is given.
+  virtual StringMap GetItemParams(int iid, bool with_tld, int pricelist = -1) {
+    StringMap item_params;
+    BillmgrCall("AddItemParam", [&] { AddItemParam(item_params, iid); });
+    if (pricelist != -1) {
+      BillmgrCall("AddItemAddon",
+                  [&] { AddItemAddon(item_params, iid, pricelist); });
+    }
+    if (with_tld) {
+      BillmgrCall("AddTldParam", [&] { AddTldParam(item_params, iid); });
+    }
+    return item_params;
+  }
+
+  virtual StringMap GetProfile(int iid, const string& type) {
+    return BillmgrCall("ServiceProfile",
+                       [&] { return ServiceProfile(iid, type); });
+  }
+
+  virtual void SaveItemParam(int iid, const string& name,
+                             const string& value) {
+    BillmgrCall("SaveParam", [&] { SaveParam(iid, name, value); });
+  }
+
+  virtual int ProfileAccount(int local_id) {
+    return GetProfileAccount(local_id);
+  }
+
+  virtual string CountryIso2(const string& local_id) {
+    return GetCountryIso2(local_id);
+  }
+
+  static StringVector GetNsVector(const StringMap& item_params) {
+    StringVector ns;
+    for (int i = 0; i < 4; ++i) {
+      auto it = item_params.find("ns" + str::Str(i));
+      if (it != item_params.end() && !it->second.empty()) {
+        ns.push_back(it->second);
+      }
+    }
+    return ns;
+  }
+
+  const DomainPrice& GetDomainPrice(int pricelist, const string& tld,
+                                    int advise = -1) {
+    Debug("Request DomainPrice pricelist=%d tld=%s advice=%d", pricelist,
+      tld.c_str(), advise);
+    int allowed_registrar = Ctx().allowed_registrar;
+    Debug("allowed_registrar=%d", allowed_registrar);
+    return FindDomainPrice(tld_prices_, tld, advise, allowed_registrar);
+  }
+
+  static std::unique_ptr<RemoteClient> Remote_NewClient(
+      const string& url, const string& authinfo) {
+    return std::unique_ptr<RemoteClient>(new RemoteClient(url, authinfo));
+  }
+
+  mgr_client::Result Remote_MakeRequest(StringMap params_copy) {
+    return Remote_MakeRequest(*Ctx().client, params_copy);
+  }
+
+  mgr_client::Result Remote_MakeRequest(RemoteClient& client,
+                                        StringMap params_copy) {
+    LogExt("Performing request: \n%s\n",
+           str::JoinParams(params_copy, "\n", " = ").c_str());
+    auto func = params_copy.find("func");
+    Span span("Remote_MakeRequest",
+              func != params_copy.end() ? func->second : "");
+    auto& trace = RemoteTrace::Instance();
+    if (trace.IsReplay()) {
+      return trace.Replay(client.id, params_copy);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start)
+          .count();
+    };
+    try {
+      mgr_client::Result ret = client.Query("", params_copy);
+      LogExt("Response: \n%s\n", ret.xml.Str().c_str());
+      trace.Record(client.id, params_copy, ret.xml.Str(), "", elapsed());
+      return ret;
+    } catch (const std::exception& e) {
+      trace.Record(client.id, params_copy, "", e.what(), elapsed());
+      throw;
+    }
+  }
+
+  int Remote_GetAccount() {
+    auto result = Remote_MakeRequest({{"func", "accountinfo"}});
+    for (auto elem : result.elems()) {
+      if (elem.FindNode("project").Str() == RUTLD_PROJECT_NAME) {
+        return str::Int(elem.FindNode("id").Str());
+      }
+    }
+    throw mgr_err::Missed("account_for_project");
+  }
+
+  // Remote contact fields of a local profile for domaincontact.edit.
+  StringMap GetContactPayload(bool is_generic, const StringMap& params) {
+    static const StringMap phone_replace_map{{"-", ""}, {"(", ""}, {")", ""}};
+
+    int local_type = str::Int(params.at("profiletype"));
+    string remote_type =
+        is_generic ? "generic"
+                   : (local_type == table::Profile::prPersonal ||
+                              local_type == table::Profile::prSoleProprietor
+                          ? "person"
+                          : "company");
+
+    StringMap request;
+    request["ctype"] = remote_type;
+    auto copy = [&request, &params](const string& dst, const string& src = "") {
+      request[dst] = params.at(!src.empty() ? src : dst);
+    };
+
+    // Common fields for all types: location address, email, phone
+    copy("email");
+    request["phone"] = str::Replace(params.at("phone"), phone_replace_map);
+    //request["fax"] = str::Replace(params.at("fax"), phone_replace_map);
+    request["la_country"] =
+        GetRemoteCountryId(CountryIso2(params.at("location_country")));
+    copy("la_state", "location_state");
+    copy("la_postcode", "location_postcode");
+    copy("la_city", "location_city");
+    copy("la_address", "location_address");
+
+    // Common fields for all russian types: postal address, mobile phone
+    if (remote_type != "generic") {
+      request["pa_country"] =
+          GetRemoteCountryId(CountryIso2(params.at("postal_country")));
+      copy("pa_state", "postal_state");
+      copy("pa_postcode", "postal_postcode");
+      copy("pa_city", "postal_city");
+      copy("pa_address", "postal_address");
+      copy("pa_addressee", "postal_addressee");
+      request["mobile"] =
+          str::Replace(!params.at("mobile").empty() ? params.at("mobile")
+                                                    : params.at("phone"),
+                       phone_replace_map);
+    }
+
+    if (remote_type == "person") {
+      copy("firstname_ru", "firstname_locale");
+      copy("middlename_ru", "middlename_locale");
+      copy("lastname_ru", "lastname_locale");
+      copy("firstname");
+      copy("middlename");
+      copy("lastname");
+      if (local_type == table::Profile::prSoleProprietor) {
+        copy("inn");
+      }
+      copy("birthdate");
+      copy("passport_series", "passport");
+      copy("passport_org");
+      copy("passport_date");
+    } else if (remote_type == "company") {
+      copy("company");
+      copy("company_ru", "company_locale");
+      copy("inn");
+      copy("kpp");
+      copy("ogrn");
+    } else if (remote_type == "generic") {
+      if (local_type == table::Profile::prPersonal) {
+        request["company"] = "N/A";
+      } else if (local_type == table::Profile::prSoleProprietor) {
+        request["company"] =
+            "IP " + params.at("firstname") + " " + params.at("lastname");
+      } else {
+        copy("company");
+      }
+      copy("firstname");
+      copy("lastname");
+    }
+    return request;
+  }
+
+  string Remote_CreateContact(const string& remote_name,
+                              const StringMap& payload) {
+    Debug("Func: Remote_CreateContact");
+
+    string remote_id = Remote_MakeRequest({{"func", "contcat.create.1"},
+                                           {"ctype", payload.at("ctype")},
+                                           {"cname", remote_name},
+                                           {"sok", "ok"}})
+                           .value("domaincontact.id");
+
+    StringMap request = payload;
+    request["func"] = "domaincontact.edit";
+    request["sok"] = "ok";
+    request["elid"] = remote_id;
+    request["name"] = remote_name;
+    Remote_MakeRequest(request);
+    return remote_id;
+  }
+
+  // Maps the profile to a remote contact. A remote contact of the same
+  // account with the same content is reused, a new one is created only if
+  // there is none. Only contacts created with the current content are
+  // indexed by hash, as the content of older ones may have changed.
+  string CreateRemoteContact(int module, bool is_generic,
+                             const StringMap& params) {
+    int local_id = str::Int(params.at("id"));
+    string remote_id = GetRemoteContactId(local_id, module, is_generic);
+    if (!remote_id.empty()) return remote_id;
+
+    int account = ProfileAccount(local_id);
+    StringMap payload = GetContactPayload(is_generic, params);
+    string hash = GetContactHash(payload);
+    remote_id = GetRemoteContactIdByHash(module, account, hash);
+    if (remote_id.empty()) {
+      remote_id = Remote_CreateContact(
+          "Remote " + params.at("id") + (is_generic ? " (generic)" : ""),
+          payload);
+      SetRemoteContactIdByHash(module, account, hash, remote_id);
+    } else {
+      Debug("Reusing remote contact %s for profile %d", remote_id.c_str(),
+            local_id);
+    }
+    SetRemoteContactId(local_id, module, is_generic, remote_id);
+    return remote_id;
+  }
+
+  StringMap CreateRemoteContacts(int module, int item,
+                                 const DomainPrice& price) {
+    auto profile = [this, item](const string& type) {
+      return GetProfile(item, type);
+    };
+    StringMap remote_contacts;
+    if (price.is_nic) {
+      remote_contacts["customer"] =
+          CreateRemoteContact(module, false, profile("owner"));
+    }
+
+    if (price.is_ru) {
+      remote_contacts["owner"] =
+          CreateRemoteContact(module, false, profile("owner"));
+    } else {
+      remote_contacts["owner"] =
+          CreateRemoteContact(module, true, profile("owner"));
+      remote_contacts["admin"] =
+          CreateRemoteContact(module, true, profile("admin"));
+      remote_contacts["bill"] =
+          CreateRemoteContact(module, true, profile("bill"));
+      remote_contacts["tech"] =
+          CreateRemoteContact(module, true, profile("tech"));
+    }
+    return remote_contacts;
+  }
+
+  void Remote_SetNS(RemoteClient& client, const string& remote_id,
+                    const StringVector& ns) {
+    StringMap request{
+        {"func", "domain.edit"}, {"sok", "ok"}, {"changens", "on"}};
+    request["elid"] = remote_id;
+    int ns_id = 1;
+    for (const auto& i : ns) {
+      request["ns" + str::Str(ns_id)] = i;
+      ++ns_id;
+    }
+    Remote_MakeRequest(client, request);
+  }
+
+  // Sets domain NS unless the remote NS set already matches. Returns true if
+  // the domain was changed. Used in bulk updates, where most NS are usually
+  // unchanged.
+  bool Remote_UpdateNS(RemoteClient& client, const string& remote_id,
+                       const StringVector& ns) {
+    auto current = Remote_MakeRequest(
+        client, {{"func", "domain.edit"}, {"elid", remote_id}, {"api", "on"}});
+    StringMap current_params;
+    for (int i = 0; i < 4; ++i) {
+      current_params["ns" + str::Str(i)] = current.value("ns" + str::Str(i));
+    }
+    if (NormalizeNs(GetNsVector(current_params)) == NormalizeNs(ns)) {
+      Debug("NS of remote domain %s are up to date", remote_id.c_str());
+      return false;
+    }
+    Remote_SetNS(client, remote_id, ns);
+    return true;
+  }
+
+  std::map<string, RemoteDomain> Remote_GetDomains() {
+    std::map<string, RemoteDomain> domains;
+    auto response = Remote_MakeRequest({{"func", "domain"}, {"api", "on"}});
+    for (auto elem : response.elems()) {
+      auto& domain = domains[elem.FindNode("id").Str()];
+      domain.status = str::Int(elem.FindNode("domainstatus").Str());
+      domain.expiredate = elem.FindNode("expire").Str();
+    }
+    return domains;
+  }
+
+  // Billmgr callback for the item. Billmgr has no batch call, so every
+  // callback is a separate request.
+  virtual void ItemCallback(const string& func, int iid,
+                            StringMap params = StringMap()) {
+    params["elid"] = str::Str(iid);
+    ClientQuery(func, params);
+  }
+
+  struct SyncCallbacks {
+    int sent = 0;
+    int skipped = 0;
+  };
+
+  void ApplySync(const SyncState& state,
+                 const std::map<string, RemoteDomain>& domains,
+                 SyncCallbacks& callbacks) {
+    auto it = domains.find(state.remote_id);
+    if (it == domains.end() || it->second.status == -1 ||
+        it->second.status == 0) {
+      // Back off, otherwise the item stays due and is retried by every sync.
+      try {
+        SaveSyncState(state, Ctx().processing_module,
+                      it == domains.end() ? -1 : it->second.status,
+                      state.has_state ? state.expiredate
+                                      : state.local_expiredate,
+                      SYNC_INTERVAL_MISSING);
+      } catch (const std::exception& e) {
+        Warning("Failed to save sync state of item %d: %s", state.item,
+                e.what());
+      }
+      throw mgr_err::Missed("remote_domain", state.remote_id);
+    }
+    int remote_status = it->second.status;
+    const string& expiredate = it->second.expiredate;
+
+    int status = -1;
+    if (remote_status == 2) {
+      status = domain_util::isDelegated;
+    } else if (remote_status == 3) {
+      status = domain_util::isNoDelegated;
+    }
+
+    if (status != -1) {
+      mgr_date::Date check(expiredate);  // Will throw if date is bad.
+      // Status may be changed in billmgr, so it is always sent.
+      ItemCallback("service.setstatus", state.item,
+                   {{"service_status", str::Str(status)}});
+      ++callbacks.sent;
+      // Billmgr already has this date, no need to set it again.
+      if (string(check) != state.local_expiredate) {
+        ItemCallback("service.setexpiredate", state.item,
+                     {{"expiredate", expiredate}});
+        ++callbacks.sent;
+      } else {
+        ++callbacks.skipped;
+      }
+    }
+    SaveSyncState(state, Ctx().processing_module, remote_status, expiredate);
+  }
+
+  // Syncs the items with a single remote domain list request. If
+  // first_required is set, a failure of the first item is thrown, otherwise
+  // failures are logged and the other items are still synced.
+  void SyncItems(const std::vector<SyncState>& states, bool first_required) {
+    SyncCallbacks callbacks;
+    auto domains = Remote_GetDomains();
+    for (size_t i = 0; i < states.size(); ++i) {
+      try {
+        ApplySync(states[i], domains, callbacks);
+      } catch (const std::exception& e) {
+        if (i == 0 && first_required) throw;
+        Warning("Failed to sync item %d: %s", states[i].item, e.what());
+      }
+    }
+    Debug("Synced %zu items with one remote request, billmgr callbacks "
+          "sent=%d skipped=%d",
+          states.size(), callbacks.sent, callbacks.skipped);
+  }
+
+  string Remote_Open(const string& domain, const DomainPrice& price, int period,
+                     const StringMap& contacts, const StringVector& ns) {
+    StringMap request{{"func", "domain.order.4"},
+                      {"sok", "ok"},
+                      {"paynow", "on"},
+                      {"countdomain", "1"},
+                      {"operation", "register"}};
+
+    string domain_without_tld =
+        domain.substr(0, domain.size() - price.tld.size() - 1);
+    Debug("domain_without_tld=%s", domain_without_tld.c_str());
+    if (domain_without_tld + "." + price.tld != domain) {
+      throw mgr_err::Error("domain_and_tld_does_not_match");
+    }
+
+    request["domain"] = domain_without_tld;
+    request["domainname_0"] = domain_without_tld;
+    request["tld"] = price.tld;
+    Warning("About to request period %d", period);
+    for (const auto& i : price.periods) {
+      Warning("Avail %d %d", i.first, i.second);
+    }
+    request["price"] = str::Str(price.id);
+    request["pricelist_0"] = str::Str(price.id);
+    request["period_0"] = str::Str(price.periods.at(period));
+    request["registrar"] = str::Str(price.registrar_id);
+    request["payfrom"] = "account" + str::Str(Remote_GetAccount());
+    for (const auto& contact : contacts) {
+      request[contact.first] = contact.second;
+    }
+    request["nslist_0"] = str::Join(ns, " ");
+    return Remote_MakeRequest(request).value("item.id");
+  }
+
+ public:
+  CLASS_NAME()
+      : Registrator(BINARY_NAME),
+        tld_prices_(GetPriceCatalog().tld_prices) {}
+
+  mgr_xml::Xml Features() override {
+    mgr_xml::Xml xml;
+    auto itemtypes = xml.GetRoot().AppendChild("itemtypes");
+    itemtypes.AppendChild("itemtype").SetProp("name", "domain");
+
+    auto params = xml.GetRoot().AppendChild("params");
+    params.AppendChild("param").SetProp("name", "username");
+    params.AppendChild("param").SetProp("name", "url");
+    params.AppendChild("param")
+        .SetProp("name", "password")
+        .SetProp("crypted", "yes");
+    params.AppendChild("param").SetProp("name", "registrar");
+
+    auto features = xml.GetRoot().AppendChild("features");
+    features.AppendChild("feature").SetProp("name",
+                                            PROCESSING_CHECK_CONNECTION);
+    features.AppendChild("feature").SetProp("name", PROCESSING_SERVICE_IMPORT);
+    features.AppendChild("feature").SetProp("name",
+                                            PROCESSING_CONNECTION_FORM_TUNE);
+    features.AppendChild("feature").SetProp("name",
+                                            PROCESSING_GET_CONTACT_TYPE);
+    // TODO: support transfer
+    // features.AppendChild("feature").SetProp("name",
+    // PROCESSING_DOMAIN_TRANSFER);
+    features.AppendChild("feature").SetProp("name",
+                                            PROCESSING_DOMAIN_UPDATE_NS);
+    features.AppendChild("feature").SetProp("name", PROCESSING_PROLONG);
+    features.AppendChild("feature").SetProp("name", PROCESSING_SYNC_ITEM);
+
+    return xml;
+  }
+
+  mgr_xml::Xml GetContactType(const string& tld) override {
+    mgr_xml::Xml out;
+    out.GetRoot().SetProp("ns", "require").SetProp("auth_code", "require");
+
+    const auto& tld_prices = tld_prices_.at(str::puny::Encode(tld));
+
+    if (tld_prices.at(0).is_ru) {
+      out.GetRoot().AppendChild("contact_type", "owner").SetProp("main", "yes");
+    } else {
+      out.GetRoot().AppendChild("contact_type", "owner");
+      out.GetRoot().AppendChild("contact_type", "admin");
+      out.GetRoot().AppendChild("contact_type", "tech");
+      out.GetRoot().AppendChild("contact_type", "bill");
+    }
+
+    return out;
+  }
+
+  void OnSetModule(const int module) override {
+    Debug("Func: OnSetModule");
+    auto& ctx = Ctx();
+    ctx.processing_module = module;
+    ctx.username = m_module_data["username"];
+    ctx.password = m_module_data["password"];
+    ctx.url = m_module_data["url"];
+    if (ctx.url.empty()) {
+      ctx.url = RUTLD_PROD_URL;
+    }
+
+    int registrar_id = str::Int(m_module_data["registrar"]);
+    ctx.allowed_registrar = registrar_id ? registrar_id : -1;
+
+    ctx.client = Remote_NewClient(ctx.url, ctx.username + ":" + ctx.password);
+  }
+
+  void CheckConnection(mgr_xml::Xml module_xml) override {
+    Debug("Func: CheckConnection");
+    BillmgrCall("SetModule", [&] {
+      m_module_data["url"] =
+          module_xml.GetNode("/doc/processingmodule/url").Str();
+      m_module_data["username"] =
+          module_xml.GetNode("/doc/processingmodule/username").Str();
+      m_module_data["password"] =
+          module_xml.GetNode("/doc/processingmodule/password").Str();
+
+      OnSetModule(0);
+    });
+
+    Remote_GetAccount();
+  }
+
+  // Returns availability of the domains for registration known from the
+  // cache. The registrar API has no documented availability check, so
+  // domains missing from the cache are not returned.
+  std::map<string, bool> CheckAvailability(const StringVector& domains) {
+    Debug("Func: CheckAvailability");
+    Span span("CheckAvailability");
+    std::set<string> names;
+    for (const auto& i : domains) {
+      names.insert(str::Lower(str::puny::Encode(i)));
+    }
+    auto ret = GetCachedAvailability(names);
+    Debug("Checked %zu domains, %zu from cache", names.size(), ret.size());
+    return ret;
+  }
+
+  void Open(const int iid) override {
+    Debug("Func: Open");
+    Span span("Open");
+    auto item = GetItem(iid);
+    UseModule(str::Int(item.at("processingmodule")));
+
+    StringMap item_params =
+        GetItemParams(iid, true, str::Int(item.at("pricelist")));
+
+    for (auto i : item_params) {
+      Warning("Item param %s=%s", i.first.c_str(), i.second.c_str());
+    }
+    for (auto i : GetProfile(iid, "owner")) {
+      Warning("Profile param %s=%s", i.first.c_str(), i.second.c_str());
+    }
+
+    const auto& remote_price = GetDomainPrice(str::Int(item.at("pricelist")),
+                                              item_params.at("tld_name"));
+
+    StringVector ns = GetNsVector(item_params);
+
+    // Fail before remote contacts are created if the domain is known to be
+    // taken. Only the cache is used, so Open sends no extra remote request.
+    // The order is not blocked if the cache cannot be read.
+    string domain = str::Lower(str::puny::Encode(item_params.at("domain")));
+    bool available = true;
+    try {
+      auto cached = GetCachedAvailability({domain});
+      available = !cached.count(domain) || cached.at(domain);
+    } catch (const std::exception& e) {
+      Warning("Failed to check availability of %s: %s", domain.c_str(),
+              e.what());
+    }
+    if (!available) {
+      throw mgr_err::Error("domain_not_available");
+    }
+
+    string remote_id = Remote_Open(
+        item_params.at("domain"), remote_price,
+        str::Int(item.at("period")) / 12,
+        CreateRemoteContacts(Ctx().processing_module, iid, remote_price), ns);
+
+    SaveItemParam(iid, PARAM_REMOTE_ID, remote_id);
+    SaveItemParam(iid, PARAM_REMOTE_PRICE, str::Str(remote_price.id));
+    // The domain is registered already, a failed cache write must not fail
+    // the operation.
+    try {
+      SetCachedAvailability(domain, false);
+    } catch (const std::exception& e) {
+      Warning("Failed to cache availability of %s: %s", domain.c_str(),
+              e.what());
+    }
+
+    ItemCallback(item.at("intname") + ".open", iid,
+                 {{"sok", "ok"}});
+
+    SyncItems(
+        {GetSyncState(iid, remote_id, item.at("expiredate"))},
+        true);
+  }
+
+  void Transfer(const int iid, StringMap& transfer_notify_request) override {
+    throw mgr_err::Error("not_implemented");
+  }
+
+  void Prolong(const int iid) override {
+    Debug("Func: Prolong");
+    Span span("Prolong");
+
+    auto item = GetItem(iid);
+    UseModule(str::Int(item.at("processingmodule")));
+
+    StringMap item_params = GetItemParams(iid, true);
+
+    const auto& remote_price = GetDomainPrice(
+        str::Int(item.at("pricelist")), item_params.at("tld_name"),
+        str::Int(item_params.at(PARAM_REMOTE_PRICE)));
+
+    Remote_MakeRequest(
+        {{"func", "domain.renew"},
+         {"sok", "ok"},
+         {"elid", item_params.at(PARAM_REMOTE_ID)},
+         {"paynow", "on"},
+         {"payfrom", "account" + str::Str(Remote_GetAccount())},
+         {"autoperiod", str::Str(remote_price.periods.at(
+                            str::Int(item.at("period")) / 12))}});
+
+    ItemCallback("service.postprolong", iid, {{"sok", "ok"}});
+    SyncItems({GetSyncState(iid, item_params.at(PARAM_REMOTE_ID),
+                            item.at("expiredate"))},
+              true);
+  }
+
+  void Suspend(const int iid) override {
+    // TODO: remove NS?
+    ClientQuery("func=service.postsuspend&sok=ok&elid=" + str::Str(iid));
+  }
+
+  void Resume(const int iid) override {
+    // TODO: restore NS?
+    ClientQuery("func=service.postresume&sok=ok&elid=" + str::Str(iid));
+  }
+
+  void Close(const int iid) override {
+    ClientQuery("func=service.postclose&sok=ok&elid=" + str::Str(iid));
+  }
+
+  // Always syncs the item, so syncs requested from billmgr take effect.
+  // Items of the module due for sync are updated from the same remote list.
+  void SyncItem(const int iid) override {
+    Debug("Func: SyncItem");
+    Span span("SyncItem");
+    auto item = GetItem(iid);
+    StringMap item_params = GetItemParams(iid, false);
+    auto remote_id = item_params.find(PARAM_REMOTE_ID);
+    if (remote_id == item_params.end() || remote_id->second.empty()) {
+      throw mgr_err::Missed("remote_domain", "");
+    }
+
+    UseModule(str::Int(item.at("processingmodule")));
+    std::vector<SyncState> states{
+        GetSyncState(iid, remote_id->second, item.at("expiredate"))};
+    for (const auto& state : GetDueSyncStates(Ctx().processing_module)) {
+      if (state.item != iid) states.push_back(state);
+    }
+    SyncItems(states, true);
+  }
+
+  // Syncs up to SYNC_BATCH_LIMIT items of the module which are due for sync
+  // with one remote request. Run periodically by the sync_due maintenance
+  // command, so that the sync intervals take effect.
+  void SyncDue(int module) {
+    Debug("Func: SyncDue");
+    Span span("SyncDue");
+    UseModule(module);
+    auto states = GetDueSyncStates(module);
+    if (states.empty()) {
+      Debug("No items of module %d are due for sync", module);
+      return;
+    }
+    SyncItems(states, false);
+  }
+
+  void UpdateNS(const int iid) override {
+    Debug("Func: UpdateNS");
+    Span span("UpdateNS");
+
+    UseModule(str::Int(GetItem(iid).at("processingmodule")));
+    StringMap item_params = GetItemParams(iid, false);
+
+    Remote_SetNS(*Ctx().client, item_params.at(PARAM_REMOTE_ID),
+                 GetNsVector(item_params));
+  }
+
+  // Updates NS of many domains at once. Item params are read sequentially,
+  // then remote NS are compared and changed by up to BULK_NS_CONCURRENCY
+  // parallel workers, each with its own connection per processing module.
+  NsUpdateReport BulkUpdateNS(const std::vector<int>& items) {
+    Debug("Func: BulkUpdateNS");
+    Span span("BulkUpdateNS");
+
+    struct Task {
+      int iid;
+      string remote_id;
+      StringVector ns;
+      string url;
+      string authinfo;
+    };
+
+    NsUpdateReport report;
+    std::vector<Task> tasks;
+    for (int iid : items) {
+      try {
+        UseModule(str::Int(GetItem(iid).at("processingmodule")));
+        StringMap item_params = GetItemParams(iid, false);
+        tasks.push_back({iid, item_params.at(PARAM_REMOTE_ID),
+                         GetNsVector(item_params), Ctx().url,
+                         Ctx().username + ":" + Ctx().password});
+      } catch (const std::exception& e) {
+        Warning("Failed to read NS of item %d: %s", iid, e.what());
+        ++report.failed;
+      }
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> changed(0), skipped(0), failed(0);
+    auto worker = [&]() {
+      std::map<string, std::unique_ptr<RemoteClient>> clients;
+      for (size_t i = next++; i < tasks.size(); i = next++) {
+        const auto& task = tasks[i];
+        try {
+          auto& client = clients[task.url + " " + task.authinfo];
+          if (!client) client = Remote_NewClient(task.url, task.authinfo);
+          if (Remote_UpdateNS(*client, task.remote_id, task.ns)) {
+            ++changed;
+          } else {
+            ++skipped;
+          }
+        } catch (const std::exception& e) {
+          Warning("Failed to update NS of item %d: %s", task.iid, e.what());
+          ++failed;
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < BULK_NS_CONCURRENCY && i < tasks.size(); ++i) {
+      threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    report.changed = changed;
+    report.skipped = skipped;
+    report.failed += failed;
+    Warning("Bulk NS update: changed=%d skipped=%d failed=%d", report.changed,
+            report.skipped, report.failed);
+    return report;
+  }
+
+  // Compares all remote domains of the module with local services in one pass:
+  // both lists are sorted by remote id and merge-joined. The registrar returns
+  // the domain list as a single response with no paging, so it is held in
+  // memory (and logged and recorded like any response) until compact remote
+  // records are built from it; local services are read from a cursor.
+  // Discrepancies are logged and counted.
+  ReconcileReport Reconcile(int module) {
+    Debug("Func: Reconcile");
+    Span span("Reconcile");
+    UseModule(module);
+
+    struct RemoteRecord {
+      string id;
+      string name;
+      int status;
+      string expiredate;
+      string price;
+    };
+    std::vector<RemoteRecord> remote;
+    {
+      auto response = Remote_MakeRequest({{"func", "domain"}, {"api", "on"}});
+      for (auto elem : response.elems()) {
+        if (Ctx().allowed_registrar != -1 &&
+            str::Int(elem.FindNode("registrarId")) != Ctx().allowed_registrar)
+          continue;
+        remote.push_back({elem.FindNode("id").Str(),
+                          elem.FindNode("name").Str(),
+                          str::Int(elem.FindNode("domainstatus").Str()),
+                          elem.FindNode("expire").Str(),
+                          elem.FindNode("price_id").Str()});
+      }
+    }
+    std::sort(remote.begin(), remote.end(),
+              [](const RemoteRecord& lhs, const RemoteRecord& rhs) {
+                return RemoteIdLess(lhs.id, rhs.id);
+              });
+
+    auto local = GetSyncDbConnection()->Query(
+        "SELECT i.id, i.status, i.expiredate, rid.value AS remote_id, "
+        "rp.value AS remote_price, i.service_status "
+        "FROM item i "
+        "JOIN itemparam rid ON rid.item = i.id AND rid.intname = '"
+        PARAM_REMOTE_ID "' "
+        "LEFT JOIN itemparam rp ON rp.item = i.id AND rp.intname = '"
+        PARAM_REMOTE_PRICE "' "
+        "WHERE i.processingmodule = ? AND i.status IN (2, 3) "
+        "ORDER BY LENGTH(rid.value), rid.value",
+        str::Str(module));
+
+    ReconcileReport report;
+    auto it = remote.begin();
+    for (; !local->Eof(); local->Next()) {
+      string remote_id = local->AsString("remote_id");
+      int iid = local->AsInt("id");
+      for (; it != remote.end() && RemoteIdLess(it->id, remote_id); ++it) {
+        Warning("Reconcile: remote domain %s (%s) has no service",
+                it->id.c_str(), it->name.c_str());
+        ++report.remote_orphans;
+      }
+      if (it == remote.end() || it->id != remote_id) {
+        Warning("Reconcile: item %d has no remote domain %s", iid,
+                remote_id.c_str());
+        ++report.local_orphans;
+        continue;
+      }
+
+      ++report.matched;
+      // Service status billmgr should have, as set by ApplySync.
+      int status = it->status == 2   ? domain_util::isDelegated
+                   : it->status == 3 ? domain_util::isNoDelegated
+                                     : -1;
+      if (status == -1 ||
+          local->AsString("service_status") != str::Str(status)) {
+        Warning("Reconcile: item %d service status %s, remote status %d", iid,
+                local->AsString("service_status").c_str(), it->status);
+        ++report.status_mismatches;
+      }
+      string remote_expiredate;
+      try {
+        remote_expiredate = mgr_date::Date(it->expiredate);
+      } catch (...) {
+      }
+      if (remote_expiredate != local->AsString("expiredate")) {
+        Warning("Reconcile: item %d expires %s, remote domain %s", iid,
+                local->AsString("expiredate").c_str(),
+                it->expiredate.c_str());
+        ++report.expire_mismatches;
+      }
+      if (it->price != local->AsString("remote_price")) {
+        Warning("Reconcile: item %d price %s, remote domain %s", iid,
+                local->AsString("remote_price").c_str(), it->price.c_str());
+        ++report.price_mismatches;
+      }
+      ++it;
+    }
+    for (; it != remote.end(); ++it) {
+      Warning("Reconcile: remote domain %s (%s) has no service",
+              it->id.c_str(), it->name.c_str());
+      ++report.remote_orphans;
+    }
+
+    Warning(
+        "Reconcile module %d: matched=%d remote_orphans=%d local_orphans=%d "
+        "status=%d expire=%d price=%d",
+        module, report.matched, report.remote_orphans, report.local_orphans,
+        report.status_mismatches, report.expire_mismatches,
+        report.price_mismatches);
+    return report;
+  }
+
+  void TuneConnection(mgr_xml::Xml& module_xml) override {
+    auto slist =
+        module_xml.GetRoot().AppendChild("slist").SetProp("name", "registrar");
+    slist.AppendChild("msg", "registrar_0").SetProp("key", "-1");
+    for (const auto& i : GetPriceCatalog().registrars) {
+      slist.AppendChild("msg", "registrar_" + str::Str(i))
+          .SetProp("key", str::Str(i));
+    }
+  }
+
+  int ImportRemoteContact(int module, const string& remote_id) {
+    auto remote = Remote_MakeRequest(
+        {{"func", "domaincontact.edit"}, {"elid", remote_id}, {"api", "on"}});
+    StringMap local {{"type", "owner"}, {"sok", "ok"}, {"module", str::Str(module)}};
+    auto copy = [&remote, &local](const string& dst, const string& src = "") {
+//	  string src0 = !src.empty() ? src : dst;
+//	  Warning("Copy %s<-%s %s", dst.c_str(), src0.c_str(), remote.value(src0).c_str());
+      local[dst] = remote.value(!src.empty() ? src : dst);
+    };
+
+    string remote_type = remote.value("ctype");
+
+    copy("email");
+    copy("phone");
+    copy("fax");
+
+    local["location_country"] = GetCountryId(GetRemoteCountryIso2(remote.value("la_country")));
+    copy("location_state", "la_state");
+    copy("location_postcode", "la_postcode");
+    copy("location_city", "la_city");
+    copy("location_address", "la_address");
+
+    // Common fields for all russian types: postal address, mobile phone
+    if (remote_type != "generic") {
+      local["postal_country"] = GetCountryId(GetRemoteCountryIso2(remote.value("pa_country")));
+      copy("postal_state", "pa_state");
+      copy("postal_postcode", "pa_postcode");
+      copy("postal_city", "pa_city");
+      copy("postal_address", "pa_address");
+      copy("postal_addressee", "pa_addressee");
+      copy("mobile");
+    }
+
+    if (remote_type == "person") {
+      copy("firstname_locale", "firstname_ru");
+      copy("middlename_locale", "middlename_ru");
+      copy("lastname_locale", "lastname_ru");
+      copy("firstname");
+      copy("middlename");
+      copy("lastname");
+      if (remote.value("inn") == "") {
+        local["profiletype"] = str::Str(table::Profile::prPersonal);
+      } else {
+        local["profiletype"] = str::Str(table::Profile::prSoleProprietor);
+        copy("inn");
+      }
+      copy("birthdate");
+      copy("passport", "passport_series");
+      copy("passport_org");
+      copy("passport_date");
+	  local["name"] = "Imported " + remote_id + " (" + local["firstname_locale"] + " " + local["lastname_locale"] + ")";
+    } else if (remote_type == "company") {
+      copy("company");
+      copy("company_locale", "company_ru");
+      copy("inn");
+      copy("kpp");
+      copy("ogrn");
+      local["profiletype"] = str::Str(table::Profile::prCompany);
+	  local["name"] = "Imported " + remote_id + " (" + local["company_locale"] + ")";
+    } else if (remote_type == "generic") {
+      if (remote.value("company") == "" || remote.value("company") == "N/A") {
+        local["profiletype"] = str::Str(table::Profile::prPersonal);
+      } else {
+        local["profiletype"] = str::Str(table::Profile::prCompany);
+        copy("company");
+      }
+      copy("firstname");
+      copy("lastname");
+	  local["name"] = "Imported " + remote_id + " (" + local["firstname"] + " " + local["lastname"] + ")";
+    }
+    int local_id = str::Int(ClientQuery("processing.import.profile", local).value("profile_id"));
+    SetRemoteContactId(local_id, module, remote_type == "generic", remote_id);
+    return local_id;
+  }
+
+  virtual void Import(const int module, const string& itemtype,
+                      const string& search) {
+    Debug("itemtype: %s, search: %s", itemtype.c_str(), search.c_str());
+    Span span("Import");
+
+    UseModule(module);
+
+    if (itemtype != "domain") {
+      throw mgr_err::Error("not_implemented");
+    }
+
+    std::set<string> search_list;
+    str::Split(search, " ", search_list);
+
+    auto domains = Remote_MakeRequest({{"func", "domain"}, {"api", "on"}});
+
+    for (auto i : domains.elems()) {
+      string domain_name = i.FindNode("name").Str();
+      if (!search_list.empty() && !search_list.count(domain_name)) continue;
+      if (Ctx().allowed_registrar != -1 &&
+          str::Int(i.FindNode("registrarId")) != Ctx().allowed_registrar)
+        continue;
+      string remote_id = i.FindNode("id").Str();
+      string tld_name = domain_name;
+      str::GetWord(tld_name, ".");
+      string tld_id = BillmgrCall("GetTldId", [&] {
+        return sbin::DB()
+            ->Query("SELECT id FROM tld WHERE name = " +
+                    sbin::DB()->EscapeValue(tld_name))
+            ->Str();
+      });
+      mgr_date::Date expiredate;
+      try {
+        expiredate = mgr_date::Date(i.FindNode("expire").Str());
+      } catch (...) {
+      }
+
+      auto domain_edit =
+          Remote_MakeRequest({{"func", "domain.edit"}, {"elid", remote_id}, {"api", "on"}});
+
+      int domain_id = str::Int(
+          ClientQuery(
+              "processing.import.service",
+              {
+                  {"sok", "ok"},
+                  {IMPORT_ITEMTYPE_INTNAME, itemtype},
+                  {IMPORT_SERVICE_NAME, domain_name},
+                  {"domain", domain_name},
+                  {IMPORT_PRICELIST_INTNAME, tld_id},
+                  {"status", (expiredate > mgr_date::Date() ? "2" : "3")},
+                  {"period", "12"},
+                  {"module", str::Str(module)},
+                  {"expiredate", expiredate},
+                  {"ns0", domain_edit.value("ns0")},
+                  {"ns1", domain_edit.value("ns1")},
+                  {"ns2", domain_edit.value("ns2")},
+                  {"ns3", domain_edit.value("ns3")},
+                  {PARAM_REMOTE_ID, remote_id},
+				  {PARAM_REMOTE_PRICE, i.FindNode("price_id").Str()}
+                  // TODO: add PARAM_REMOTE_PRICE
+              })
+              .value("service_id"));
+      if (domain_id == 0) throw mgr_err::Error("domain_import");
+      int account = str::Int(BillmgrCall("GetItemAccount", [&] {
+        return sbin::DB()
+            ->Query("SELECT account FROM item WHERE id = " +
+                    str::Str(domain_id))
+            ->Str();
+      }));
+
+      std::set<string> required_contacts =
+          RUSSIAN_ZONES().count(tld_name)
+              ? std::set<string>({"owner"})
+              : std::set<string>({"owner", "admin", "bill", "tech"});
+
+      for (const auto& contact_type : required_contacts) {
+        string remote_contact_id = domain_edit.value(contact_type);
+        if (remote_contact_id.empty()) {
+          throw mgr_err::Missed("contact_" + contact_type);
+        }
+        int local_contact_id =
+            GetLocalContactId(module, account, remote_contact_id);
+        if (local_contact_id == -1) {
+          local_contact_id = ImportRemoteContact(module, remote_contact_id);
+        }
+        ClientQuery("service_profile2item.edit",
+                    {{"sok", "ok"},
+                     {"service_profile", str::Str(local_contact_id)},
+                     {"item", str::Str(domain_id)},
+                     {"type", contact_type}});
+      }
+    }
+  }
+};
+}  // namespace
+
+#endif  // RUTLD_H__
@@ -0,0 +1,421 @@
+#include "rutld.h"
+
+#include <iostream>
+
+// Stress test of concurrent operations in one module process.
+//
+// Open, Prolong and SyncItem run at once in STRESS_THREADS threads on the
+// items of STRESS_MODULES processing modules, each thread switching between
+// modules. Billmgr is faked by overriding the billmgr calls of the module and
+// the registrar by a replay responder answering by the requesting client:
+// every module has its own registrar account and the ids returned carry the
+// module, so a request made with the client of another module fails or leaves
+// a wrong id. Afterwards remote ids, billmgr callbacks of every item, contact
+// mapping and sync state rows are checked.
+//
+// Contact mapping, availability cache and sync state tables of the billmgr
+// database are used (point it to a MySQL/MariaDB stand-in); rows are written
+// for negative module and item ids and deleted afterwards. Run from the
+// billmgr directory with the etc/ files of the module installed:
+//   make stress
+//   cd /usr/local/mgr5 && src/pmrutlddomains/rutldstress
+
+#define STRESS_THREADS 16
+#define STRESS_MODULES 8
+// Items of each module.
+#define STRESS_ITEMS 8
+// Module ids are STRESS_FIRST_MODULE, STRESS_FIRST_MODULE - 1, ...
+#define STRESS_FIRST_MODULE -101
+// Domain names start with this label prefix.
+#define STRESS_DOMAIN_PREFIX "rutld-stress-"
+// Expiration dates: local before Open, remote after Open and after Prolong.
+#define STRESS_LOCAL_EXPIRE "2030-01-01"
+#define STRESS_OPEN_EXPIRE "2031-01-01"
+#define STRESS_PROLONG_EXPIRE "2032-01-01"
+
+namespace {
+
+string ModuleUrl(int module) {
+  return "https://" + str::Str(-module) + ".stress.example";
+}
+
+string ModuleUsername(int module) { return "user" + str::Str(-module); }
+
+string ModulePassword(int module) { return "password" + str::Str(-module); }
+
+// Prefix of remote ids of the module.
+string ModulePrefix(int module) { return "m" + str::Str(-module) + "-"; }
+
+int ModuleAccount(int module) { return 1000 - module; }
+
+bool StartsWith(const string& value, const string& prefix) {
+  return value.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Registrar faked by the replay responder.
+class FakeRegistrar {
+ public:
+  string Respond(const string& client, const StringMap& params) {
+    int module = ClientModule(client);
+    const string prefix = ModulePrefix(module);
+    auto value = [&params](const string& name) {
+      auto it = params.find(name);
+      return it != params.end() ? it->second : string();
+    };
+    const string func = value("func");
+    auto require = [&func](bool condition, const string& what) {
+      if (!condition) throw mgr_err::Error("stress_request", func, what);
+    };
+    const string payfrom = "account" + str::Str(ModuleAccount(module));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (func == "accountinfo") {
+      return "<doc><elem><id>" + str::Str(ModuleAccount(module)) +
+             "</id><project>" RUTLD_PROJECT_NAME "</project></elem></doc>";
+    } else if (func == "contcat.create.1") {
+      string id = prefix + "c" + str::Str(++contacts_);
+      return "<doc><domaincontact.id>" + id + "</domaincontact.id></doc>";
+    } else if (func == "domaincontact.edit") {
+      require(StartsWith(value("elid"), prefix), "elid");
+      return "<doc/>";
+    } else if (func == "domain.order.4") {
+      require(value("payfrom") == payfrom, "payfrom");
+      require(params.count("owner"), "owner");
+      for (const char* contact :
+           {"customer", "owner", "admin", "bill", "tech"}) {
+        require(!params.count(contact) ||
+                    StartsWith(params.at(contact), prefix),
+                contact);
+      }
+      string id = prefix + value("domain") + "." + value("tld");
+      require(!expire_.count(id), "domain");
+      expire_[id] = STRESS_OPEN_EXPIRE;
+      return "<doc><item.id>" + id + "</item.id></doc>";
+    } else if (func == "domain.renew") {
+      require(value("payfrom") == payfrom, "payfrom");
+      require(StartsWith(value("elid"), prefix) && expire_.count(value("elid")),
+              "elid");
+      expire_[value("elid")] = STRESS_PROLONG_EXPIRE;
+      return "<doc/>";
+    } else if (func == "domain") {
+      string ret = "<doc>";
+      for (const auto& i : expire_) {
+        if (!StartsWith(i.first, prefix)) continue;
+        ret += "<elem><id>" + i.first +
+               "</id><domainstatus>2</domainstatus><expire>" + i.second +
+               "</expire></elem>";
+      }
+      return ret + "</doc>";
+    }
+    throw mgr_err::Value("func", func);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<string, string> expire_;
+  int contacts_ = 0;
+
+  // Module of the client, checked against the whole client id.
+  static int ClientModule(const string& client) {
+    const string scheme = "https://";
+    int module = -str::Int(
+        client.substr(scheme.size(), client.find('.') - scheme.size()));
+    if (client != RemoteClient::Id(ModuleUrl(module),
+                                   ModuleUsername(module) + ":" +
+                                       ModulePassword(module))) {
+      throw mgr_err::Value("client", client);
+    }
+    return module;
+  }
+};
+
+// Module with billmgr faked.
+class StressModule : public CLASS_NAME {
+ public:
+  struct Item {
+    int module;
+    StringMap item;
+    StringMap params;
+    StringVector callbacks;
+  };
+
+  StressModule() {
+    const auto& countries = GetRemoteCountries().id_by_iso2;
+    if (countries.empty()) throw mgr_err::Missed("remote_country");
+    iso2_ = countries.begin()->first;
+  }
+
+  void AddModule(int module, int registrar) {
+    modules_[module] = {{"url", ModuleUrl(module)},
+                        {"username", ModuleUsername(module)},
+                        {"password", ModulePassword(module)},
+                        {"registrar", str::Str(registrar)}};
+  }
+
+  void AddItem(int iid, int module, const string& domain, const string& tld,
+               int period) {
+    Item& item = items_[iid];
+    item.module = module;
+    item.item = {{"processingmodule", str::Str(module)},
+                 {"pricelist", "0"},
+                 {"period", str::Str(period)},
+                 {"intname", "domain"},
+                 {"expiredate", STRESS_LOCAL_EXPIRE}};
+    item.params = {{"domain", domain},
+                   {"tld_name", tld},
+                   {"ns0", "ns1.stress.example"},
+                   {"ns1", "ns2.stress.example"}};
+  }
+
+  const std::map<int, Item>& items() const { return items_; }
+
+ protected:
+  // Switches to the module the way SetModule does, with the module data
+  // taken from the fake instead of the database.
+  void UseModule(int module) override {
+    std::lock_guard<std::recursive_mutex> lock(BillmgrMutex());
+    m_module_data = modules_.at(module);
+    OnSetModule(module);
+  }
+
+  StringMap GetItem(int iid) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.at(iid).item;
+  }
+
+  StringMap GetItemParams(int iid, bool with_tld, int pricelist) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.at(iid).params;
+  }
+
+  // Profiles are shared by the items of a module.
+  StringMap GetProfile(int iid, const string& type) override {
+    static const StringVector types{"owner", "admin", "bill", "tech"};
+    int module = GetItemModule(iid);
+    int index = std::find(types.begin(), types.end(), type) - types.begin();
+    string address = "Stress st. " + str::Str(-module);
+    return {{"id", str::Str(module * 10 - index)},
+            {"profiletype", str::Str(table::Profile::prPersonal)},
+            {"email", type + "@" + str::Str(-module) + ".stress.example"},
+            {"phone", "+7 (495) 000-00-00"},
+            {"mobile", ""},
+            {"location_country", "1"},
+            {"location_state", "Moscow"},
+            {"location_postcode", "101000"},
+            {"location_city", "Moscow"},
+            {"location_address", address},
+            {"postal_country", "1"},
+            {"postal_state", "Moscow"},
+            {"postal_postcode", "101000"},
+            {"postal_city", "Moscow"},
+            {"postal_address", address},
+            {"postal_addressee", "Stress " + type},
+            {"firstname_locale", "Stress"},
+            {"middlename_locale", "Stress"},
+            {"lastname_locale", type},
+            {"firstname", "Stress"},
+            {"middlename", "Stress"},
+            {"lastname", type},
+            {"birthdate", "1990-01-01"},
+            {"passport", "0000 000000"},
+            {"passport_org", "Stress"},
+            {"passport_date", "2010-01-01"}};
+  }
+
+  void SaveItemParam(int iid, const string& name,
+                     const string& value) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    items_.at(iid).params[name] = value;
+  }
+
+  int ProfileAccount(int local_id) override { return local_id / 10; }
+
+  string CountryIso2(const string& local_id) override { return iso2_; }
+
+  // Records the callback; setexpiredate changes the item like billmgr does.
+  void ItemCallback(const string& func, int iid, StringMap params) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Item& item = items_.at(iid);
+    if (params["elid"] != str::Str(iid)) {
+      item.callbacks.push_back(func + " elid=" + params["elid"]);
+    } else if (func == "service.setexpiredate") {
+      item.callbacks.push_back(func + " " + params["expiredate"]);
+      item.item["expiredate"] = params["expiredate"];
+    } else {
+      item.callbacks.push_back(func);
+    }
+  }
+
+ private:
+  std::map<int, StringMap> modules_;
+  std::map<int, Item> items_;
+  std::mutex mutex_;
+  string iso2_;
+
+  int GetItemModule(int iid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.at(iid).module;
+  }
+};
+
+void DeleteStressRows() {
+  const string first = str::Str(STRESS_FIRST_MODULE - STRESS_MODULES + 1);
+  const string last = str::Str(STRESS_FIRST_MODULE);
+  for (const char* table : {CONTACT_MAPPING_TABLE_NAME,
+                            CONTACT_HASH_TABLE_NAME, SYNC_STATE_TABLE_NAME}) {
+    GetSyncDbConnection()->Query(string("DELETE FROM ") + table +
+                                     " WHERE processingmodule BETWEEN ? AND ?",
+                                 first, last);
+  }
+  GetCheckDbConnection()->Query("DELETE FROM " DOMAIN_CHECK_TABLE_NAME
+                                " WHERE domain LIKE '" STRESS_DOMAIN_PREFIX
+                                "%'");
+}
+
+// Tlds to register: "ru" with its own contact set and a tld with generic
+// contacts, if the price list has them.
+StringVector GetStressTlds() {
+  StringVector ret;
+  const auto& tld_prices = GetPriceCatalog().tld_prices;
+  if (tld_prices.count("ru")) ret.push_back("ru");
+  for (const auto& i : tld_prices) {
+    if (!i.second.empty() && !i.second.front().is_ru) {
+      ret.push_back(i.first);
+      break;
+    }
+  }
+  if (ret.empty()) throw mgr_err::Missed("tld_price");
+  return ret;
+}
+
+int CheckResults(const StressModule& module) {
+  int failures = 0;
+  auto fail = [&failures](const string& what) {
+    std::cerr << what << std::endl;
+    ++failures;
+  };
+  const StringVector expected{"domain.open",
+                              "service.setstatus",
+                              "service.setexpiredate " STRESS_OPEN_EXPIRE,
+                              "service.postprolong",
+                              "service.setstatus",
+                              "service.setexpiredate " STRESS_PROLONG_EXPIRE,
+                              "service.setstatus"};
+  for (const auto& i : module.items()) {
+    const auto& item = i.second;
+    const string name = "item " + str::Str(i.first) + ": ";
+    auto remote_id = item.params.find(PARAM_REMOTE_ID);
+    if (remote_id == item.params.end() ||
+        remote_id->second !=
+            ModulePrefix(item.module) + item.params.at("domain")) {
+      fail(name + "wrong remote id");
+    }
+    if (item.callbacks != expected) {
+      fail(name + "callbacks " + str::Join(item.callbacks, ", "));
+    }
+    auto state = GetSyncDbConnection()->Query(
+        "SELECT processingmodule, remote_status, expiredate FROM "
+        SYNC_STATE_TABLE_NAME " WHERE item = ?",
+        str::Str(i.first));
+    if (!state->First() || state->AsInt("processingmodule") != item.module ||
+        state->AsInt("remote_status") != 2 ||
+        state->AsString("expiredate") != STRESS_PROLONG_EXPIRE) {
+      fail(name + "wrong sync state");
+    }
+  }
+  for (int m = 0; m < STRESS_MODULES; ++m) {
+    int module_id = STRESS_FIRST_MODULE - m;
+    const string name = "module " + str::Str(module_id) + ": ";
+    auto mapping = GetContactDbConnection()->Query(
+        "SELECT externalid FROM " CONTACT_MAPPING_TABLE_NAME
+        " WHERE processingmodule = ?",
+        str::Str(module_id));
+    int rows = 0;
+    for (; !mapping->Eof(); mapping->Next(), ++rows) {
+      if (!StartsWith(mapping->Str(), ModulePrefix(module_id))) {
+        fail(name + "wrong contact " + mapping->Str());
+      }
+    }
+    if (!rows) fail(name + "no contacts");
+  }
+  return failures;
+}
+
+int Run() {
+  FakeRegistrar registrar;
+  RemoteTrace::Instance().SetResponder(
+      [&registrar](const string& client, const StringMap& params) {
+        return registrar.Respond(client, params);
+      });
+  DeleteStressRows();
+
+  // Modules use the tlds in turn; every other pair of modules is limited to
+  // the registrar of the first price of its tld.
+  StressModule module;
+  const auto& tld_prices = GetPriceCatalog().tld_prices;
+  StringVector tlds = GetStressTlds();
+  std::vector<int> items;
+  for (int i = 0; i < STRESS_ITEMS; ++i) {
+    for (int m = 0; m < STRESS_MODULES; ++m) {
+      int module_id = STRESS_FIRST_MODULE - m;
+      const string& tld = tlds[m % tlds.size()];
+      int registrar = m % 4 < 2 ? 0 : tld_prices.at(tld).front().registrar_id;
+      const auto& price =
+          FindDomainPrice(tld_prices, tld, -1, registrar ? registrar : -1);
+      if (!i) module.AddModule(module_id, registrar);
+      int iid = module_id * 100 - i;
+      module.AddItem(iid, module_id,
+                     STRESS_DOMAIN_PREFIX + str::Str(-module_id) + "-" +
+                         str::Str(i) + "." + tld,
+                     tld, price.periods.begin()->first * 12);
+      items.push_back(iid);
+    }
+  }
+
+  // Every thread works on items of several modules and runs each operation
+  // on all its items in turn, so threads overlap in different operations.
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < STRESS_THREADS; ++t) {
+    threads.emplace_back([&module, &failures, &items, t] {
+      for (const string operation : {"Open", "Prolong", "SyncItem"}) {
+        for (size_t i = t; i < items.size(); i += STRESS_THREADS) {
+          try {
+            if (operation == "Open") {
+              module.Open(items[i]);
+            } else if (operation == "Prolong") {
+              module.Prolong(items[i]);
+            } else {
+              module.SyncItem(items[i]);
+            }
+          } catch (const std::exception& e) {
+            std::cerr << operation << " " << items[i] << ": " << e.what()
+                      << std::endl;
+            ++failures;
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  failures += CheckResults(module);
+  DeleteStressRows();
+  std::cout << "threads=" << STRESS_THREADS << " modules=" << STRESS_MODULES
+            << " items=" << items.size() << " failures=" << failures
+            << std::endl;
+  return failures ? 1 : 0;
+}
+
+}  // namespace
+
+int main() {
+  try {
+    return Run();
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,57 @@
+#include "rutld.h"
+
+// Maintenance commands billmgr has no processing module call for. The program
+// runs through RUN_MODULE exactly as the module does and takes the arguments
+// of the module import command: the item type names the maintenance command,
+// the search string holds its arguments. Results are written to the module
+// log. Run it from the billmgr directory:
+//   processing/rutldtool --command import --module 5 --itemtype reconcile
+//   processing/rutldtool --command import --module 5 --itemtype bulk_update_ns
+//       --searchstring "101 102"
+//   processing/rutldtool --command import --module 5 --itemtype sync_due
+//   processing/rutldtool --command import --module 5 --itemtype check
+//       --searchstring "example.ru example.com"
+
+namespace {
+
+std::vector<int> GetIds(const string& search) {
+  StringVector words;
+  str::Split(search, " ", words);
+  std::vector<int> ids;
+  for (const auto& i : words) {
+    if (i.empty()) continue;
+    ids.push_back(str::Int(i));
+    if (str::Str(ids.back()) != i) throw mgr_err::Value("item", i);
+  }
+  return ids;
+}
+
+class MaintenanceModule : public CLASS_NAME {
+ public:
+  void Import(const int module, const string& command,
+              const string& search) override {
+    Debug("Maintenance command %s %s", command.c_str(), search.c_str());
+    if (command == "bulk_update_ns") {
+      auto report = BulkUpdateNS(GetIds(search));
+      if (report.failed) throw mgr_err::Error("bulk_update_ns");
+    } else if (command == "sync_due") {
+      SyncDue(module);
+    } else if (command == "reconcile") {
+      Reconcile(module);
+    } else if (command == "check") {
+      StringVector domains;
+      str::Split(search, " ", domains);
+      auto checked = CheckAvailability(domains);
+      for (const auto& i : checked) {
+        Warning("Domain %s is %s", i.first.c_str(),
+                i.second ? "available" : "taken");
+      }
+    } else {
+      throw mgr_err::Value("itemtype", command);
+    }
+  }
+};
+
+}  // namespace
+
+RUN_MODULE(MaintenanceModule)